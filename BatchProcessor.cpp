@@ -0,0 +1,196 @@
+#include "BatchProcessor.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace {
+    long long microsecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+BatchProcessor::BatchProcessor(const BatchConfig& config)
+        : config(config),
+          workerCount(config.workers > 0 ? config.workers
+                                         : std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 2 * std::max(1, config.ioThreads))),
+          slots(config.buffers > 0 ? config.buffers : workerCount + 2 * std::max(1, config.ioThreads)),
+          freeSlots(slots.size()), readSlots(slots.size()), filteredSlots(std::max(1, config.ioThreads))
+{
+    this->config.ioThreads = std::max(1, config.ioThreads);
+    //with a known mesh size every buffer is allocated up front, the scans only overwrite them
+    if (config.filter.width > 0 && config.filter.height > 0) {
+        for (auto& slot : slots) {
+            slot.cloud.resize(config.filter.width, config.filter.height);
+        }
+    }
+    for (int i = 0; i < workerCount; ++i) {
+        filters.push_back(std::make_unique<BilateralFilter>("", "", config.filter));
+        filters.back()->setThreadCount(1);
+    }
+}
+
+BatchProcessor::~BatchProcessor() = default;
+
+bool BatchProcessor::readManifest(const std::string& filename, std::vector<BatchJob>& jobs)
+{
+    std::ifstream manifest(filename);
+    if (!manifest) {
+        std::cerr << "Unable to open manifest: " << filename << std::endl;
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(manifest, line)) {
+        ++lineNumber;
+        std::istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.input) || job.input[0] == '#') continue;
+        if (!(fields >> job.output)) {
+            std::cerr << "Manifest line " << lineNumber << " has no output file: " << filename << std::endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+bool BatchProcessor::scanDirectory(const std::string& inputDirectory, const std::string& outputDirectory, std::vector<BatchJob>& jobs)
+{
+    std::error_code error;
+    std::vector<std::filesystem::path> inputs;
+    for (const auto& entry : std::filesystem::directory_iterator(inputDirectory, error)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".ply") inputs.push_back(entry.path());
+    }
+    if (error) {
+        std::cerr << "Unable to read directory: " << inputDirectory << std::endl;
+        return false;
+    }
+    std::filesystem::create_directories(outputDirectory, error);
+    //sorted so batches run in a repeatable order
+    std::sort(inputs.begin(), inputs.end());
+    for (const auto& input : inputs) {
+        jobs.push_back({input.string(), (std::filesystem::path(outputDirectory) / input.filename()).string()});
+    }
+    return true;
+}
+
+void BatchProcessor::readLoop(const std::vector<BatchJob>& jobs)
+{
+    PlyReader reader;
+    for (;;) {
+        const size_t job = nextJob.fetch_add(1);
+        if (job >= jobs.size()) break;
+        int slot;
+        const auto waitStart = std::chrono::steady_clock::now();
+        if (!freeSlots.pop(slot)) break;
+        readerStallMicroseconds += microsecondsSince(waitStart);
+        Slot& target = slots[slot];
+        target.job = job;
+        if (!reader.open(jobs[job].input)) {
+            std::cerr << "Unable to open file: " << reader.error() << "\n";
+            ++failedScans;
+            freeSlots.push(slot);
+            continue;
+        }
+        int width = config.filter.width, height = config.filter.height;
+        if (!BilateralFilter::resolveMeshSize(reader, width, height)) {
+            std::cerr << "Mesh size of " << jobs[job].input << " is unknown" << std::endl;
+            ++failedScans;
+            freeSlots.push(slot);
+            continue;
+        }
+        //a scan of another size would be cut off or padded with invalid points
+        if (reader.vertexCount() != static_cast<size_t>(width) * height) {
+            std::cerr << jobs[job].input << " has " << reader.vertexCount() << " vertices, the batch mesh is "
+                      << width << "x" << height << std::endl;
+            ++failedScans;
+            freeSlots.push(slot);
+            continue;
+        }
+        target.cloud.resize(width, height);
+        target.cloud.clear();
+        if (reader.readVertices(0, target.cloud.size(), target.cloud, 0) == 0) {
+            std::cerr << jobs[job].input << " has no valid vertices" << std::endl;
+            ++failedScans;
+            freeSlots.push(slot);
+            continue;
+        }
+        readSlots.push(slot);
+    }
+    if (--activeReaders == 0) readSlots.close();
+}
+
+void BatchProcessor::workLoop(int worker)
+{
+    BilateralFilter& filter = *filters[worker];
+    int slot;
+    while (readSlots.pop(slot)) {
+        filter.filterPointCloud(slots[slot].cloud);
+        const auto waitStart = std::chrono::steady_clock::now();
+        filteredSlots.push(slot);
+        workerStallMicroseconds += microsecondsSince(waitStart);
+    }
+    if (--activeWorkers == 0) filteredSlots.close();
+}
+
+void BatchProcessor::writeLoop(const std::vector<BatchJob>& jobs)
+{
+    //one writer per thread keeps its output buffer across scans
+    PlyWriter writer;
+    int slot;
+    while (filteredSlots.pop(slot)) {
+        const Slot& source = slots[slot];
+        const std::string& output = jobs[source.job].output;
+        const bool organized = config.filter.organizedOutput;
+        if (organized) writer.setGrid(source.cloud.width(), source.cloud.height());
+        bool ok = writer.open(output, config.filter.outputFormat, organized ? source.cloud.size() : source.cloud.validCount());
+        if (ok) {
+            writer.writePoints(source.cloud, 0, source.cloud.size(), organized);
+            ok = writer.close();
+        }
+        if (ok) {
+            ++finishedScans;
+        }
+        else {
+            std::cerr << "Unable to write file: " << output << std::endl;
+            ++failedScans;
+        }
+        freeSlots.push(slot);
+    }
+}
+
+BatchReport BatchProcessor::run(const std::vector<BatchJob>& jobs)
+{
+    freeSlots.reset();
+    readSlots.reset();
+    filteredSlots.reset();
+    for (size_t slot = 0; slot < slots.size(); ++slot) freeSlots.push(static_cast<int>(slot));
+    nextJob = 0;
+    failedScans = 0;
+    finishedScans = 0;
+    readerStallMicroseconds = 0;
+    workerStallMicroseconds = 0;
+    activeReaders = config.ioThreads;
+    activeWorkers = workerCount;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < config.ioThreads; ++i) threads.emplace_back(&BatchProcessor::readLoop, this, std::cref(jobs));
+    for (int i = 0; i < workerCount; ++i) threads.emplace_back(&BatchProcessor::workLoop, this, i);
+    for (int i = 0; i < config.ioThreads; ++i) threads.emplace_back(&BatchProcessor::writeLoop, this, std::cref(jobs));
+    for (auto& thread : threads) thread.join();
+
+    BatchReport report;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    report.scans = finishedScans;
+    report.failed = failedScans;
+    report.scansPerSecond = report.seconds > 0.0 ? report.scans / report.seconds : 0.0;
+    report.readerStallSeconds = readerStallMicroseconds * 1e-6;
+    report.workerStallSeconds = workerStallMicroseconds * 1e-6;
+    return report;
+}
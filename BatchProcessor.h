@@ -0,0 +1,88 @@
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BilateralFilter.h"
+#include "BoundedQueue.h"
+#include "OrganizedPointCloud.h"
+#include "PlyIO.h"
+
+//One scan of a batch, the input mesh is bilateral filtered into the output mesh.
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+struct BatchConfig {
+    //filter of every scan, with its mesh size, output format and organized output. The threads are the workers
+    //below, each worker filters its scan on one thread. A mesh size of 0 is read from the header of each scan,
+    //the buffers then grow to the largest scan and are reused after that
+    BilateralFilterConfig filter;
+    //reader threads and, as many again, writer threads
+    int ioThreads = 2;
+    //compute workers, 0 uses the hardware threads that are left after the I/O threads
+    int workers = 0;
+    //point cloud buffers in flight, 0 gives every thread one buffer
+    int buffers = 0;
+};
+
+struct BatchReport {
+    size_t scans = 0;
+    size_t failed = 0;
+    double seconds = 0.0;
+    double scansPerSecond = 0.0;
+    //time readers waited for a free buffer because writing fell behind, summed over the readers
+    double readerStallSeconds = 0.0;
+    //time workers waited for room in the write queue, which holds one scan per writer
+    double workerStallSeconds = 0.0;
+};
+
+//Filters many scans with a fixed set of buffers.
+//Readers load scans into free buffers, workers filter them in place and writers save them, the stages
+//are connected by bounded queues. Every buffer, every worker's filter state and every writer's output
+//buffer is allocated once and reused, so after the first scan of each worker nothing is allocated per scan.
+//The write queue holds one filtered scan per writer. When the disk cannot keep up it fills, workers stop with
+//their scan and the readers run out of buffers.
+class BatchProcessor {
+public:
+    explicit BatchProcessor(const BatchConfig& config);
+    ~BatchProcessor();
+    BatchProcessor(const BatchProcessor&) = delete;
+    BatchProcessor& operator=(const BatchProcessor&) = delete;
+
+    //one "input output" pair per line, empty lines and lines starting with # are skipped
+    static bool readManifest(const std::string& filename, std::vector<BatchJob>& jobs);
+    //every .ply file of inputDirectory, written under the same name to outputDirectory
+    static bool scanDirectory(const std::string& inputDirectory, const std::string& outputDirectory, std::vector<BatchJob>& jobs);
+
+    BatchReport run(const std::vector<BatchJob>& jobs);
+
+private:
+    struct Slot {
+        OrganizedPointCloud cloud;
+        size_t job = 0;
+    };
+    void readLoop(const std::vector<BatchJob>& jobs);
+    void workLoop(int worker);
+    void writeLoop(const std::vector<BatchJob>& jobs);
+
+    BatchConfig config;
+    int workerCount;
+    std::vector<Slot> slots;
+    std::vector<std::unique_ptr<BilateralFilter>> filters;//one per worker
+    BoundedQueue<int> freeSlots;
+    BoundedQueue<int> readSlots;
+    BoundedQueue<int> filteredSlots;//one entry per writer, smaller than the pool so a slow disk stalls the workers
+    std::atomic<size_t> nextJob{0};
+    std::atomic<int> activeReaders{0};
+    std::atomic<int> activeWorkers{0};
+    std::atomic<size_t> failedScans{0};
+    std::atomic<size_t> finishedScans{0};
+    std::atomic<long long> readerStallMicroseconds{0};
+    std::atomic<long long> workerStallMicroseconds{0};
+};
+
+#endif // BATCHPROCESSOR_H
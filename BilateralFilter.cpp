@@ -1,66 +1,140 @@
 #include "BilateralFilter.h"
-#include <fstream>
-#include <sstream>
 #include <cmath>
 #include <iostream>
 #include <limits>
+#include <chrono>
+#include <algorithm>
+#include "Trace.h"
+
+namespace {
+    //rows of a tile should fit in L2 together with their neighbor rows
+    constexpr size_t tileBytes = 256 * 1024;
+}
 
 BilateralFilter::BilateralFilter(const std::string& inputFilename, const std::string& outputFilename)
         : inputFilename(inputFilename), outputFilename(outputFilename) {}
 
+BilateralFilter::BilateralFilter(const std::string& inputFilename, const std::string& outputFilename, const BilateralFilterConfig& config)
+        : inputFilename(inputFilename), outputFilename(outputFilename), threadCount(config.threads), vectorized(config.vectorized),
+          doublePrecision(config.doublePrecision), outputFormat(config.outputFormat), organizedOutput(config.organizedOutput), streamingBandRows(config.streamingBandRows),
+          iterations(config.iterations), spatialSigma(config.spatialSigma), rangeSigma(config.rangeSigma),
+          radius(config.radius), separable(config.separable), distanceSigma(config.distanceSigma), meshWidth(config.width), meshHeight(config.height) {}
 
+void BilateralFilter::setThreadCount(int threads) {
+    threadCount = threads;
+    threadPool.reset();
+}
 
-float BilateralFilter::gaussian(float x, float sigma) {
-    static const float sqrt2pi = std::sqrt(2 * M_PI);
-    return std::exp(-0.5f * x * x / (sigma * sigma)) / (sigma * sqrt2pi);
+void BilateralFilter::setVectorized(bool enabled) {
+    vectorized = enabled;
 }
-void BilateralFilter::applyBilateralFilter(std::vector<std::vector<std::vector<float>>>& pointCloud, int iterations,float spatialSigma,float rangeSigma) {
-    int width = pointCloud.size();
-    int height = pointCloud[0].size();
 
-    for (int iter = 0; iter < iterations; ++iter) {
-        auto originalPointCloud = pointCloud;
-        for (int x = 0; x < width; ++x) {
-            for (int y = 0; y < height; ++y) {
-                if (std::isnan(originalPointCloud[x][y][0])) continue;//can be removed
-                // Calculate adaptive sigma values based on local neighborhood
-
-                std::vector<float> filteredPoint(6, 0.0f);//x,y,z,nx,ny,nz
-                float weightSum = 0.0f;
-                //spatialsigma σc
-                //rangesigma σs
-                //Iterating 8
-                for (int i = -1; i <= 1; ++i) {
-                    for (int j = -1; j <= 1; ++j) {
-                        if (i == 0 && j == 0) continue;//center
-                        int nx = x + i, ny = y + j;
-                        if (nx >= 0 && nx < width && ny >= 0 && ny < height && !std::isnan(originalPointCloud[nx][ny][0])) {
-                            // Compute spatial weight
-                            float spatialWeight = gaussian(std::sqrt(float(i * i + j * j)), spatialSigma);
-                            //range weight
-                            float normalDiff = std::sqrt(
-                                    (originalPointCloud[nx][ny][3] - originalPointCloud[x][y][3]) * (originalPointCloud[nx][ny][3] - originalPointCloud[x][y][3]) +
-                                    (originalPointCloud[nx][ny][4] - originalPointCloud[x][y][4]) * (originalPointCloud[nx][ny][4] - originalPointCloud[x][y][4]) +
-                                    (originalPointCloud[nx][ny][5] - originalPointCloud[x][y][5]) * (originalPointCloud[nx][ny][5] - originalPointCloud[x][y][5]));
-                            float rangeWeight = gaussian(normalDiff, rangeSigma);
-                            //Adding weights
-                            float weight = spatialWeight * rangeWeight;
-                            weightSum += weight;
-                            //Updating
-                            for (int k = 0; k < 6; ++k) {
-                                filteredPoint[k] += originalPointCloud[nx][ny][k] * weight;
-                            }
-                        }
-                    }
-                }
-                //updating point cloud
-                if (weightSum > 0) {
-                    for (int k = 0; k < 6; ++k) {
-                        pointCloud[x][y][k] = filteredPoint[k] / weightSum;
-                    }
-                }
+void BilateralFilter::setOutputFormat(PlyFormat format) {
+    outputFormat = format;
+}
+
+void BilateralFilter::setStreaming(int bandRows) {
+    streamingBandRows = bandRows;
+}
+
+void BilateralFilter::setIterations(int count) {
+    iterations = count;
+}
+
+void BilateralFilter::setSigmas(float spatial, float range) {
+    spatialSigma = spatial;
+    rangeSigma = range;
+}
+
+void BilateralFilter::setWindow(int radius, bool separable, float distanceSigma) {
+    this->radius = radius;
+    this->separable = separable;
+    this->distanceSigma = distanceSigma;
+}
+
+void BilateralFilter::setMeshSize(int width, int height) {
+    meshWidth = width;
+    meshHeight = height;
+}
+
+bool BilateralFilter::resolveMeshSize(const PlyReader& reader) {
+    return resolveMeshSize(reader, meshWidth, meshHeight);
+}
+
+bool BilateralFilter::resolveMeshSize(const PlyReader& reader, int& width, int& height) {
+    if (width > 0 && height > 0) return true;
+    const PlyHeader& header = reader.header();
+    const size_t vertices = reader.vertexCount();
+    if (header.gridRows > 0 && header.gridCols > 0) {
+        width = header.gridRows;
+        height = header.gridCols;
+    }
+    //one given side and the vertex count of an organized file give the other
+    else if (width > 0 && vertices % width == 0) {
+        height = static_cast<int>(vertices / width);
+    }
+    else if (height > 0 && vertices % height == 0) {
+        width = static_cast<int>(vertices / height);
+    }
+    if (width <= 0 || height <= 0) {
+        std::cerr << "Unknown mesh size, the PLY header has no obj_info num_rows / num_cols" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool BilateralFilter::resolveMeshSize(const std::string& filename) {
+    if (meshWidth > 0 && meshHeight > 0) return true;
+    PlyReader reader;
+    if (!reader.open(filename)) {
+        std::cerr << "Unable to open file: " << reader.error() << "\n";
+        return false;
+    }
+    return resolveMeshSize(reader);
+}
+
+
+
+void BilateralFilter::applyBilateralFilter(OrganizedPointCloud& pointCloud, int iterations,float spatialSigma,float rangeSigma) {
+    KIVI_TRACE_SCOPE("applyBilateralFilter");
+    KIVI_TRACE_COUNT("bilateral_points", static_cast<int64_t>(pointCloud.size()) * iterations);
+    //every iteration reads pointCloud and writes scratchCloud, then the buffers are swapped instead of copied
+    scratchCloud.resize(pointCloud.width(), pointCloud.height());
+    scratchCloud.copyMaskFrom(pointCloud);
+
+    if (!threadPool) {
+        threadPool = std::make_unique<ThreadPool>(threadCount);
+    }
+    //every point only depends on the previous iteration, so tiles can run in any order and match the serial result
+    size_t rowBytes = std::max<size_t>(1, pointCloud.height() * OrganizedPointCloud::ChannelCount * sizeof(float));
+    int tileRows = static_cast<int>(std::max<size_t>(1, tileBytes / rowBytes));
+
+    if (radius > 1) {
+        //one or two wide passes replace several 3x3 iterations
+        const WideBilateralKernel wide(radius, spatialSigma, distanceSigma, rangeSigma, vectorized);
+        const WideBilateralKernel::Pass fullPass[] = {WideBilateralKernel::Pass::Full};
+        const WideBilateralKernel::Pass separablePasses[] = {WideBilateralKernel::Pass::AlongY, WideBilateralKernel::Pass::AlongX};
+        const WideBilateralKernel::Pass* passes = separable ? separablePasses : fullPass;
+        const int passCount = separable ? 2 : 1;
+        for (int iter = 0; iter < iterations; ++iter) {
+            for (int p = 0; p < passCount; ++p) {
+                const WideBilateralKernel::Pass pass = passes[p];
+                threadPool->parallelFor(pointCloud.width(), tileRows, [&](int firstRow, int lastRow) {
+                    KIVI_TRACE_SCOPE("bilateral_rows");
+                    wide.filterRows(pointCloud, scratchCloud, firstRow, lastRow, pass);
+                });
+                pointCloud.swap(scratchCloud);
             }
         }
+        return;
+    }
+    const BilateralKernel kernel(spatialSigma, rangeSigma, vectorized, doublePrecision);
+    for (int iter = 0; iter < iterations; ++iter) {
+        threadPool->parallelFor(pointCloud.width(), tileRows, [&](int firstRow, int lastRow) {
+            KIVI_TRACE_SCOPE("bilateral_rows");
+            kernel.filterRows(pointCloud, scratchCloud, firstRow, lastRow);
+        });
+        pointCloud.swap(scratchCloud);
     }
 }
 //this version is without iterations
@@ -118,105 +192,189 @@ void BilateralFilter::applyBilateralFilter(std::vector<std::vector<std::vector<f
 }
 */
 
-void BilateralFilter::writePLYFile(const std::string& filename, const std::vector<std::vector<std::vector<float>>>& organized_point_cloud, bool organized = false) {
-    std::ofstream plyFile(filename);
-
-    if (!plyFile) {
+void BilateralFilter::writePLYFile(const std::string& filename, const OrganizedPointCloud& organized_point_cloud, bool organized) {
+    KIVI_TRACE_SCOPE("writePLYFile");
+    if (!PlyWriter::write(filename, organized_point_cloud, organized, outputFormat)) {
         std::cout << "Unable to open file";
-        return;
     }
+}
 
-    // Calculate total vertices
-    size_t totalVertices = 0;
-    if (!organized){
-        for (const auto& row : organized_point_cloud) {
-            for (const auto& pt : row) {
-                if (!std::isnan(pt[0])) { // assuming if x is NaN, the entire point is invalid
-                    totalVertices++;
-                }
-            }
-        }
+OrganizedPointCloud BilateralFilter::readPLYFileWithNormals(const std::string& filename,int width,int height) {
+    KIVI_TRACE_SCOPE("readPLYFileWithNormals");
+    OrganizedPointCloud organized_point_cloud(width, height);  // Initialize with NaN values, every point invalid
+    PlyReader reader;
+
+    if (!reader.open(filename)) {
+        std::cerr << "Unable to open file: " << reader.error() << "\n";
+        return organized_point_cloud;  // return empty opc
     }
-    else {
-        totalVertices = organized_point_cloud.size() * organized_point_cloud[0].size();
-    }
-
-
-    plyFile << "ply\n";
-    plyFile << "format ascii 1.0\n";
-    plyFile << "element vertex " << totalVertices << "\n";
-    plyFile << "property float x\n";
-    plyFile << "property float y\n";
-    plyFile << "property float z\n";
-    plyFile << "property float nx\n";
-    plyFile << "property float ny\n";
-    plyFile << "property float nz\n";
-    plyFile << "element face " << 0 << "\n";
-    plyFile << "property list uchar int vertex_indices\n";
-    plyFile << "end_header\n";
-
-    for (const auto& row : organized_point_cloud) {
-        for (const auto& pt : row) {
-            if (organized || !std::isnan(pt[0])) { // assuming if x is NaN, the entire point is invalid
-                plyFile << pt[0] << " " << pt[1] << " " << pt[2] << " "
-                        << pt[3] << " " << pt[4] << " " << pt[5] << "\n";
-            }
+
+    //the reader counts the invalid vertices in ply_invalid_vertices
+    reader.readVertices(0, organized_point_cloud.size(), organized_point_cloud, 0);
+    return organized_point_cloud;
+}
+bool BilateralFilter::reportThreadScaling(int maxThreads) {
+    if (!resolveMeshSize(inputFilename)) return false;
+    PlyReader reader;
+    if (!reader.open(inputFilename)) {
+        std::cerr << "Unable to open file: " << reader.error() << "\n";
+        return false;
+    }
+    const auto input = readPLYFileWithNormals(inputFilename,meshWidth,meshHeight);
+    OrganizedPointCloud pointCloud, serialResult;
+    double serialSeconds = 0.0;
+    bool identical = true;
+    for (int threads = 1; threads <= maxThreads; ++threads) {
+        setThreadCount(threads);
+        pointCloud.copyFrom(input);
+        auto start = std::chrono::steady_clock::now();
+        applyBilateralFilter(pointCloud,iterations,spatialSigma,rangeSigma);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        //rows are split between threads, never the sums of one point, so every count must match one thread
+        if (threads == 1) {
+            serialSeconds = seconds;
+            serialResult.copyFrom(pointCloud);
+        }
+        else if (!pointCloud.identicalTo(serialResult)) {
+            std::cerr << "Threads: " << threads << " changed the filtered cloud" << std::endl;
+            identical = false;
         }
+        std::cout << "Threads: " << threads << " Time: " << seconds << " s Speedup: " << serialSeconds / seconds << std::endl;
     }
+    return identical;
 }
 
-std::vector<std::vector<std::vector<float>>> BilateralFilter::readPLYFileWithNormals(const std::string& filename,int width,int height) {
-    std::ifstream inFile(filename);
-    std::vector<std::vector<std::vector<float>>> organized_point_cloud(width, std::vector<std::vector<float>>(height, std::vector<float>(6, std::numeric_limits<float>::quiet_NaN())));  // Initialize with NaN values
+bool BilateralFilter::processFilterStreaming(size_t& validPoints) {
+    //the mesh is filtered in row bands with a halo of radius rows per iteration, so peak memory depends on the band size
+    PlyReader reader;
+    if (!reader.open(inputFilename)) {
+        std::cerr << "Unable to open file: " << reader.error() << "\n";
+        return false;
+    }
+    if (!resolveMeshSize(reader)) return false;
+    PlyWriter writer;
+    if (organizedOutput) writer.setGrid(meshWidth, meshHeight);
+    if (!writer.open(outputFilename, outputFormat)) {
+        std::cerr << "Unable to open file: " << outputFilename << std::endl;
+        return false;
+    }
 
-    std::string line;
+    //every iteration lets a band border move radius rows inwards, a halo of that many rows keeps the band exact
+    const int halo = iterations * std::max(1, radius);
+    const int bandRows = std::max(1, streamingBandRows);
+    const size_t windowPoints = static_cast<size_t>(std::min(meshWidth, bandRows + 2 * halo)) * meshHeight;
+    OrganizedPointCloud rawWindow, window;
+    rawWindow.reserve(windowPoints);
+    window.reserve(windowPoints);
+    scratchCloud.reserve(windowPoints);
 
+    int rawStart = 0, rawEnd = 0;//rows of the mesh held by rawWindow
+    validPoints = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int bandStart = 0; bandStart < meshWidth; bandStart += bandRows) {
+        const int bandEnd = std::min(meshWidth, bandStart + bandRows);
+        const int windowStart = std::max(0, bandStart - halo);
+        const int windowEnd = std::min(meshWidth, bandEnd + halo);
 
-    if (!inFile) {
-        std::cerr << "Unable to open file\n";
-        return organized_point_cloud;  // return empty opc
-    }
+        //slide the raw window, only rows that were not read yet come from the file
+        rawWindow.dropRows(windowStart - rawStart);
+        const int keptRows = std::max(0, rawEnd - windowStart);
+        rawWindow.resize(windowEnd - windowStart, meshHeight);
+        const int firstNewRow = windowStart + keptRows;
+        validPoints += reader.readVertices(static_cast<size_t>(firstNewRow) * meshHeight,
+                                           static_cast<size_t>(windowEnd - firstNewRow) * meshHeight,
+                                           rawWindow, static_cast<size_t>(keptRows) * meshHeight);
+        reader.discardBefore(static_cast<size_t>(windowEnd) * meshHeight);
+        rawStart = windowStart;
+        rawEnd = windowEnd;
 
-    // Read and skip header lines until we reach end_header
-    while (std::getline(inFile, line)) {
-        if (line == "end_header\r") //"end_header case does not break"
-        {
-            break;
-        }
+        window.copyFrom(rawWindow);
+        applyBilateralFilter(window,iterations,spatialSigma,rangeSigma);
+        writer.writePoints(window, static_cast<size_t>(bandStart - windowStart) * meshHeight,
+                           static_cast<size_t>(bandEnd - bandStart) * meshHeight, organizedOutput);
     }
+    if (!writer.close()) {
+        std::cerr << "Unable to write file: " << outputFilename << std::endl;
+        return false;
+    }
+    std::cout << "Streamed " << validPoints << " points in bands of " << bandRows << " rows in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+    return true;
+}
 
-    int nan = 0;
-    int no_nan = 0;
-    int current_row = 0, current_col = 0;
-
-    // Read data lines
-    while (std::getline(inFile, line) && current_row < width) {
-        std::istringstream lineStream(line);
-        float x, y, z, nx, ny, nz;
+void BilateralFilter::filterPointCloud(OrganizedPointCloud& pointCloud) {
+    applyBilateralFilter(pointCloud,iterations,spatialSigma,rangeSigma);
+}
 
-        // If parsing succeeds and none of the values are NaN
-        if ((lineStream >> x >> y >> z >> nx >> ny >> nz)) {
-            organized_point_cloud[current_row][current_col] = { x, y, z, nx, ny, nz };
-            no_nan++;
-        }
-        else {
-            nan++;
-        }
+bool BilateralFilter::filterPointCloud(CompactPointCloud& pointCloud) {
+    KIVI_TRACE_SCOPE("filterCompactPointCloud");
+    if (radius > 1 || doublePrecision) {
+        std::cerr << "The compact cloud is only filtered with the 8-neighbor float kernel, not with radius "
+                  << radius << (doublePrecision ? " in double precision" : "") << std::endl;
+        return false;
+    }
+    KIVI_TRACE_COUNT("bilateral_points", static_cast<int64_t>(pointCloud.size()) * iterations);
+    //the validity bits do not change, they are copied once and the passes only write depth and normals
+    compactScratch.copyLayoutFrom(pointCloud);
+    if (!threadPool) {
+        threadPool = std::make_unique<ThreadPool>(threadCount);
+    }
+    const size_t rowBytes = std::max<size_t>(1, pointCloud.height() * (sizeof(float) + sizeof(uint32_t)));
+    const int tileRows = static_cast<int>(std::max<size_t>(1, tileBytes / rowBytes));
+    const BilateralKernel kernel(spatialSigma, rangeSigma, vectorized);
+    const size_t rowBufferSize = BilateralKernel::compactRowBufferSize(pointCloud.height());
+    for (int iter = 0; iter < iterations; ++iter) {
+        threadPool->parallelFor(pointCloud.width(), tileRows, [&](int firstRow, int lastRow) {
+            KIVI_TRACE_SCOPE("bilateral_rows");
+            kernel.filterRows(pointCloud, compactScratch, firstRow, lastRow, rowArena.allocate<float>(rowBufferSize));
+        });
+        pointCloud.swap(compactScratch);
+        rowArena.reset();
+    }
+    return true;
+}
 
-        current_col++;
-        if (current_col >= height) {
-            current_col = 0;
-            current_row++;
-        }
+bool BilateralFilter::loadPointCloud(OrganizedPointCloud& pointCloud) {
+    KIVI_TRACE_SCOPE("loadPointCloud");
+    PlyReader reader;
+    if (!reader.open(inputFilename)) {
+        std::cerr << "Unable to open file: " << reader.error() << "\n";
+        return false;
     }
+    if (!resolveMeshSize(reader)) return false;
+    pointCloud.resize(meshWidth, meshHeight);
+    pointCloud.clear();
+    reader.readVertices(0, pointCloud.size(), pointCloud, 0);
+    return true;
+}
 
-    std::cout << "Nan: " << nan << " Not Nan: " << no_nan << std::endl;
-    return organized_point_cloud;
+bool BilateralFilter::savePointCloud(const OrganizedPointCloud& pointCloud) {
+    KIVI_TRACE_SCOPE("savePointCloud");
+    if (!PlyWriter::write(outputFilename, pointCloud, organizedOutput, outputFormat)) {
+        std::cerr << "Unable to write file: " << outputFilename << std::endl;
+        return false;
+    }
+    return true;
 }
-void BilateralFilter::processFilter() {
+
+bool BilateralFilter::processFilter() {
+    if (streamingBandRows > 0) {
+        size_t validPoints = 0;
+        if (!processFilterStreaming(validPoints)) return false;
+        std::cout << "Bilateral filtering completed. Filtered point cloud saved to " << outputFilename << std::endl;
+        return true;
+    }
+    if (!resolveMeshSize(inputFilename)) return false;
     auto pointCloud = readPLYFileWithNormals(inputFilename,meshWidth,meshHeight);
     //applyBilateralFilter(pointCloud,spatialSigma,rangeSigma);
-    applyBilateralFilter(pointCloud,10,spatialSigma,rangeSigma);
-    writePLYFile(outputFilename, pointCloud);
+    auto start = std::chrono::steady_clock::now();
+    applyBilateralFilter(pointCloud,iterations,spatialSigma,rangeSigma);
+    const char* isa = radius > 1 ? (WideBilateralKernel(radius, spatialSigma, distanceSigma, rangeSigma, vectorized).isVectorized() ? "AVX2" : "scalar")
+                                 : BilateralKernel(spatialSigma, rangeSigma, vectorized, doublePrecision).isaName();
+    const int window = 2 * std::max(1, radius) + 1;
+    std::cout << "Filtering took " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+              << " s on " << threadPool->size() << " threads (" << isa << " kernel, " << window << "x" << window << " window)" << std::endl;
+    if (!savePointCloud(pointCloud)) return false;
     std::cout << "Bilateral filtering completed. Filtered point cloud saved to " << outputFilename << std::endl;
+    return true;
 }
\ No newline at end of file
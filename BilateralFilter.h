@@ -3,24 +3,109 @@
 
 #include <vector>
 #include <string>
+#include <cmath>
+#include <memory>
+#include "OrganizedPointCloud.h"
+#include "ThreadPool.h"
+#include "BilateralKernel.h"
+#include "CompactPointCloud.h"
+#include "PlyIO.h"
+#include "FrameArena.h"
+
+//Filter parameters, the defaults are the 2592x1944 scans of the original setup.
+struct BilateralFilterConfig {
+    //organized size of the input mesh, 0 takes it from the obj_info lines of the PLY header or the vertex count
+    int width = 2592, height = 1944;
+    int iterations = 10;
+    float spatialSigma = std::exp(-12);
+    float rangeSigma = std::exp(-12);
+    //1 is the original 8-neighbor kernel, 2 to 7 give 5x5 to 15x15 windows weighted by 3D distance and normals
+    int radius = 1;
+    //windows above 3x3 run as a pass along y and a pass along x, false visits the whole window
+    bool separable = true;
+    //3D distance sigma of windows above 3x3 in scene units, 0 weights by the normals only
+    float distanceSigma = 0.0f;
+    //0 uses every hardware thread
+    int threads = 0;
+    bool vectorized = true;
+    //accumulates the weighted sums of the 8-neighbor kernel in double, runs it scalar
+    bool doublePrecision = false;
+    PlyFormat outputFormat = PlyFormat::BinaryLittleEndian;
+    //keeps invalid points in the output so it can be read back organized, e.g. as an incremental reference
+    bool organizedOutput = false;
+    //rows per band for out-of-core filtering, 0 loads the whole mesh
+    int streamingBandRows = 0;
+};
 
 class BilateralFilter {
 public:
+    //for clouds handed over in memory, without input or output file
+    BilateralFilter() = default;
     BilateralFilter(const std::string& inputFilename, const std::string& outputFilename);
-    void processFilter();
+    BilateralFilter(const std::string& inputFilename, const std::string& outputFilename, const BilateralFilterConfig& config);
+    //filters the input file into the output file, in bands when streaming is set, false when either fails
+    bool processFilter();
+    //filters the input in bands of the streaming rows straight into the output, validPoints counts the points read
+    bool processFilterStreaming(size_t& validPoints);
+    //filters a cloud that is already in memory, e.g. from Triangulator, with the configured iterations
+    void filterPointCloud(OrganizedPointCloud& pointCloud);
+    //the same on a compact cloud, depth moves along the camera rays. Only the 8-neighbor float kernel exists
+    //for it, false for a larger window or double precision
+    bool filterPointCloud(CompactPointCloud& pointCloud);
+    //reads the input mesh, false when the file cannot be opened
+    bool loadPointCloud(OrganizedPointCloud& pointCloud);
+    //writes the cloud to the output file in the output format
+    bool savePointCloud(const OrganizedPointCloud& pointCloud);
+    //0 uses every hardware thread
+    void setThreadCount(int threads);
+    //filters the input with 1 to maxThreads threads and prints the runtime of each,
+    //false when the input cannot be read or a thread count changes the result
+    bool reportThreadScaling(int maxThreads);
+    //false forces the scalar kernel, which matches the original filter bit for bit
+    void setVectorized(bool enabled);
+    //binary little endian by default, ASCII stays available for tools that need text
+    void setOutputFormat(PlyFormat format);
+    //rows per band for out-of-core filtering, 0 loads the whole mesh
+    void setStreaming(int bandRows);
+    void setIterations(int count);
+    void setSigmas(float spatial, float range);
+    //radius 1 is the 8-neighbor kernel, see BilateralFilterConfig
+    void setWindow(int radius, bool separable, float distanceSigma);
+    //organized size of the input mesh, 0 reads it from the file
+    void setMeshSize(int width, int height);
+    //fills in a width or height of 0 from the obj_info lines or the vertex count of the header of reader,
+    //false when the size stays unknown
+    static bool resolveMeshSize(const PlyReader& reader, int& width, int& height);
 private:
+    friend class KiviBenchAccess;//kivi_bench times the private stages
+    //fills in a mesh width or height of 0 from the header of reader
+    bool resolveMeshSize(const PlyReader& reader);
+    bool resolveMeshSize(const std::string& filename);
 
-    float gaussian(float x, float sigma);
     //void applyBilateralFilter(std::vector<std::vector<std::vector<float>>>& pointCloud,float spatialSigma,float rangeSigma);
-    void applyBilateralFilter(std::vector<std::vector<std::vector<float>>>& pointCloud,int iteration,float spatialSigma,float rangeSigma);
-    void writePLYFile(const std::string& filename, const std::vector<std::vector<std::vector<float>>>& organized_point_cloud, bool organized);
-    std::vector<std::vector<std::vector<float>>> readPLYFileWithNormals(const std::string& filename, int width, int height);
+    void applyBilateralFilter(OrganizedPointCloud& pointCloud,int iteration,float spatialSigma,float rangeSigma);
+    void writePLYFile(const std::string& filename, const OrganizedPointCloud& organized_point_cloud, bool organized = false);
+    OrganizedPointCloud readPLYFileWithNormals(const std::string& filename, int width, int height);
     std::string inputFilename;
     std::string outputFilename;
+    OrganizedPointCloud scratchCloud;//second buffer for ping-pong iterations
+    CompactPointCloud compactScratch;
+    FrameArena rowArena;//decoded rows of the compact vector path, one buffer per tile
+    int threadCount = 0;
+    bool vectorized = true;
+    bool doublePrecision = false;
+    PlyFormat outputFormat = PlyFormat::BinaryLittleEndian;
+    bool organizedOutput = false;
+    int streamingBandRows = 0;
+    int iterations = 10;
+    std::unique_ptr<ThreadPool> threadPool;
     float spatialSigma = std::exp(-12);
     float rangeSigma = std::exp(-12);
-    const int meshWidth = 2592;
-    const int meshHeight = 1944;
+    int radius = 1;
+    bool separable = true;
+    float distanceSigma = 0.0f;
+    int meshWidth = 2592;
+    int meshHeight = 1944;
 
 };
 
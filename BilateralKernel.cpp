@@ -0,0 +1,682 @@
+#include "BilateralKernel.h"
+#include <algorithm>
+#include <cmath>
+#include "CompactPointCloud.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define KIVI_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+BilateralKernel::BilateralKernel(float spatialSigma, float rangeSigma, bool vectorized, bool doubleAccumulator)
+        : rangeSigma(rangeSigma), selectedIsa(vectorized && !doubleAccumulator ? detectIsa() : Isa::Scalar),
+          doubleAccumulator(doubleAccumulator)
+{
+    //only two distinct distances exist in a 3x3 neighborhood, compute their weights once
+    const float rangeNorm = gaussian(0.0f, rangeSigma);
+    for (int i = -1; i <= 1; ++i) {
+        for (int j = -1; j <= 1; ++j) {
+            spatialWeights[i + 1][j + 1] = gaussian(std::sqrt(float(i * i + j * j)), spatialSigma);
+            combinedWeights[i + 1][j + 1] = spatialWeights[i + 1][j + 1] * rangeNorm;
+        }
+    }
+    rangeExponentScale = -0.5f / (rangeSigma * rangeSigma);
+}
+
+float BilateralKernel::gaussian(float x, float sigma) const
+{
+    static const float sqrt2pi = std::sqrt(2 * M_PI);
+    return std::exp(-0.5f * x * x / (sigma * sigma)) / (sigma * sqrt2pi);
+}
+
+BilateralKernel::Isa BilateralKernel::detectIsa()
+{
+#ifdef KIVI_X86_SIMD
+    if (__builtin_cpu_supports("avx512f")) return Isa::Avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return Isa::Avx2;
+#endif
+    return Isa::Scalar;
+}
+
+const char* BilateralKernel::isaName() const
+{
+    switch (selectedIsa) {
+        case Isa::Avx512: return "AVX-512";
+        case Isa::Avx2: return "AVX2";
+        default: return "scalar";
+    }
+}
+
+void BilateralKernel::filterRows(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow) const
+{
+    switch (selectedIsa) {
+        case Isa::Avx512: filterRowsAvx512(source, target, firstRow, lastRow); break;
+        case Isa::Avx2: filterRowsAvx2(source, target, firstRow, lastRow); break;
+        default: filterRowsScalar(source, target, firstRow, lastRow); break;
+    }
+}
+
+void BilateralKernel::filterRowsScalar(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow) const
+{
+    for (int x = firstRow; x < lastRow; ++x) {
+        if (doubleAccumulator) filterPoints<double>(source, target, x, 0, source.height());
+        else filterPoints<float>(source, target, x, 0, source.height());
+    }
+}
+
+void BilateralKernel::filterPointsScalar(const OrganizedPointCloud& source, OrganizedPointCloud& target, int x, int firstCol, int lastCol) const
+{
+    filterPoints<float>(source, target, x, firstCol, lastCol);
+}
+
+template<typename Accumulator>
+void BilateralKernel::filterPoints(const OrganizedPointCloud& source, OrganizedPointCloud& target, int x, int firstCol, int lastCol) const
+{
+    const int width = source.width();
+    const int height = source.height();
+    const uint8_t* valid = source.validMask();
+    const float* in[OrganizedPointCloud::ChannelCount];
+    float* out[OrganizedPointCloud::ChannelCount];
+    for (int k = 0; k < OrganizedPointCloud::ChannelCount; ++k) {
+        in[k] = source.channel(k);
+        out[k] = target.channel(k);
+    }
+
+    for (int y = firstCol; y < lastCol; ++y) {
+        const size_t p = source.index(x, y);
+        //points that are invalid or have no weighted neighbor keep their value
+        for (int k = 0; k < 6; ++k) {
+            out[k][p] = in[k][p];
+        }
+        if (!valid[p]) continue;
+
+        Accumulator filteredPoint[6] = {0, 0, 0, 0, 0, 0};//x,y,z,nx,ny,nz
+        Accumulator weightSum = 0;
+        //spatialsigma σc
+        //rangesigma σs
+        //Iterating 8
+        for (int i = -1; i <= 1; ++i) {
+            for (int j = -1; j <= 1; ++j) {
+                if (i == 0 && j == 0) continue;//center
+                int nx = x + i, ny = y + j;
+                if (nx >= 0 && nx < width && ny >= 0 && ny < height) {
+                    const size_t q = source.index(nx, ny);
+                    if (!valid[q]) continue;
+                    float spatialWeight = spatialWeights[i + 1][j + 1];
+                    //range weight
+                    float normalDiff = std::sqrt(
+                            (in[3][q] - in[3][p]) * (in[3][q] - in[3][p]) +
+                            (in[4][q] - in[4][p]) * (in[4][q] - in[4][p]) +
+                            (in[5][q] - in[5][p]) * (in[5][q] - in[5][p]));
+                    float rangeWeight = gaussian(normalDiff, rangeSigma);
+                    //Adding weights
+                    Accumulator weight = static_cast<Accumulator>(spatialWeight) * rangeWeight;
+                    weightSum += weight;
+                    //Updating
+                    for (int k = 0; k < 6; ++k) {
+                        filteredPoint[k] += in[k][q] * weight;
+                    }
+                }
+            }
+        }
+        //updating point cloud
+        if (weightSum > 0) {
+            for (int k = 0; k < 6; ++k) {
+                out[k][p] = filteredPoint[k] / weightSum;
+            }
+        }
+    }
+}
+
+void BilateralKernel::filterRows(const CompactPointCloud& source, CompactPointCloud& target, int firstRow, int lastRow, float* rowBuffer) const
+{
+    if (selectedIsa != Isa::Scalar) {
+        filterCompactAvx2(source, target, firstRow, lastRow, rowBuffer);
+        return;
+    }
+    for (int x = firstRow; x < lastRow; ++x) {
+        filterCompactScalar(source, target, x, 0, source.height());
+    }
+}
+
+void BilateralKernel::filterCompactScalar(const CompactPointCloud& source, CompactPointCloud& target, int x, int firstCol, int lastCol) const
+{
+    const int width = source.width();
+    const int height = source.height();
+    const float* inDepth = source.depth();
+    const uint32_t* inNormal = source.normals();
+    float* outDepth = target.depth();
+    uint32_t* outNormal = target.normals();
+
+    for (int y = firstCol; y < lastCol; ++y) {
+        const size_t p = source.index(x, y);
+        outDepth[p] = inDepth[p];
+        outNormal[p] = inNormal[p];
+        if (!source.isValid(p)) continue;
+
+        float cnx, cny, cnz;
+        CompactPointCloud::decodeNormal(inNormal[p], cnx, cny, cnz);
+        float filteredPoint[4] = {0.0f, 0.0f, 0.0f, 0.0f};//z,nx,ny,nz
+        float weightSum = 0.0f;
+        for (int i = -1; i <= 1; ++i) {
+            for (int j = -1; j <= 1; ++j) {
+                if (i == 0 && j == 0) continue;
+                int nx = x + i, ny = y + j;
+                if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+                const size_t q = source.index(nx, ny);
+                if (!source.isValid(q)) continue;
+                float n[3];
+                CompactPointCloud::decodeNormal(inNormal[q], n[0], n[1], n[2]);
+                float normalDiff = std::sqrt((n[0] - cnx) * (n[0] - cnx) + (n[1] - cny) * (n[1] - cny) + (n[2] - cnz) * (n[2] - cnz));
+                float weight = spatialWeights[i + 1][j + 1] * gaussian(normalDiff, rangeSigma);
+                weightSum += weight;
+                filteredPoint[0] += inDepth[q] * weight;
+                for (int k = 0; k < 3; ++k) {
+                    filteredPoint[k + 1] += n[k] * weight;
+                }
+            }
+        }
+        if (weightSum > 0) {
+            outDepth[p] = filteredPoint[0] / weightSum;
+            //the encoding normalizes, the weighted mean of the normals needs no division
+            outNormal[p] = CompactPointCloud::encodeNormal(filteredPoint[1], filteredPoint[2], filteredPoint[3]);
+        }
+    }
+}
+
+WideBilateralKernel::WideBilateralKernel(int radius, float spatialSigma, float distanceSigma, float normalSigma, bool vectorized)
+        : windowRadius(std::max(1, radius)),
+          distanceExponentScale(distanceSigma > 0.0f ? -0.5f / (distanceSigma * distanceSigma) : 0.0f),
+          normalExponentScale(-0.5f / (normalSigma * normalSigma)),
+          useAvx2(vectorized && BilateralKernel::detectIsa() != BilateralKernel::Isa::Scalar)
+{
+    //the normalisation of the gaussians cancels in the weighted mean, only the exponent is kept
+    const float spatialScale = -0.5f / (spatialSigma * spatialSigma);
+    for (int i = -windowRadius; i <= windowRadius; ++i) {
+        for (int j = -windowRadius; j <= windowRadius; ++j) {
+            const Offset offset = {i, j, std::exp(spatialScale * float(i * i + j * j))};
+            fullOffsets.push_back(offset);
+            if (i == 0) yOffsets.push_back(offset);
+            if (j == 0) xOffsets.push_back(offset);
+        }
+    }
+}
+
+void WideBilateralKernel::filterRows(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow, Pass pass) const
+{
+    const std::vector<Offset>& offsets = pass == Pass::AlongY ? yOffsets : pass == Pass::AlongX ? xOffsets : fullOffsets;
+    if (useAvx2) {
+        filterRowsAvx2(source, target, firstRow, lastRow, offsets);
+        return;
+    }
+    for (int x = firstRow; x < lastRow; ++x) {
+        filterPointsScalar(source, target, x, 0, source.height(), offsets);
+    }
+}
+
+void WideBilateralKernel::filterPointsScalar(const OrganizedPointCloud& source, OrganizedPointCloud& target, int x, int firstCol, int lastCol, const std::vector<Offset>& offsets) const
+{
+    const int width = source.width();
+    const int height = source.height();
+    const uint8_t* valid = source.validMask();
+    const float* in[OrganizedPointCloud::ChannelCount];
+    float* out[OrganizedPointCloud::ChannelCount];
+    for (int k = 0; k < OrganizedPointCloud::ChannelCount; ++k) {
+        in[k] = source.channel(k);
+        out[k] = target.channel(k);
+    }
+
+    for (int y = firstCol; y < lastCol; ++y) {
+        const size_t p = source.index(x, y);
+        for (int k = 0; k < 6; ++k) {
+            out[k][p] = in[k][p];
+        }
+        if (!valid[p]) continue;
+
+        float filteredPoint[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        float weightSum = 0.0f;
+        for (const Offset& offset : offsets) {
+            const int nx = x + offset.dx, ny = y + offset.dy;
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+            const size_t q = source.index(nx, ny);
+            if (!valid[q]) continue;
+            float distance2 = 0.0f, normal2 = 0.0f;
+            for (int k = 0; k < 3; ++k) {
+                distance2 += (in[k][q] - in[k][p]) * (in[k][q] - in[k][p]);
+                normal2 += (in[k + 3][q] - in[k + 3][p]) * (in[k + 3][q] - in[k + 3][p]);
+            }
+            float weight = offset.weight * std::exp(distanceExponentScale * distance2 + normalExponentScale * normal2);
+            weightSum += weight;
+            for (int k = 0; k < 6; ++k) {
+                filteredPoint[k] += in[k][q] * weight;
+            }
+        }
+        if (weightSum > 0) {
+            for (int k = 0; k < 6; ++k) {
+                out[k][p] = filteredPoint[k] / weightSum;
+            }
+        }
+    }
+}
+
+#ifdef KIVI_X86_SIMD
+
+namespace {
+    //Cephes style expf: exp(x) = 2^n * e^r with |r| <= ln2/2, degree 5 polynomial for e^r.
+    //Relative error below 2e-7 for x in [-87.3, 0], results under FLT_MIN are returned as zero.
+    constexpr float expMin = -87.33654f;
+    constexpr float log2e = 1.44269504088896341f;
+    constexpr float ln2Hi = 0.693359375f;
+    constexpr float ln2Lo = -2.12194440e-4f;
+    constexpr float expP0 = 1.9875691500e-4f;
+    constexpr float expP1 = 1.3981999507e-3f;
+    constexpr float expP2 = 8.3334519073e-3f;
+    constexpr float expP3 = 4.1665795894e-2f;
+    constexpr float expP4 = 1.6666665459e-1f;
+    constexpr float expP5 = 5.0000001201e-1f;
+
+    __attribute__((target("avx2,fma")))
+    inline __m256 exp256(__m256 x)
+    {
+        const __m256 minX = _mm256_set1_ps(expMin);
+        __m256 underflow = _mm256_cmp_ps(x, minX, _CMP_LT_OQ);
+        x = _mm256_max_ps(x, minX);
+        __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2Hi), x);
+        r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2Lo), r);
+        __m256 p = _mm256_set1_ps(expP0);
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expP1));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expP2));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expP3));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expP4));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expP5));
+        p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+        __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+        return _mm256_andnot_ps(underflow, _mm256_mul_ps(p, _mm256_castsi256_ps(exponent)));
+    }
+
+    __attribute__((target("avx512f")))
+    inline __m512 exp512(__m512 x)
+    {
+        const __m512 minX = _mm512_set1_ps(expMin);
+        __mmask16 inRange = _mm512_cmp_ps_mask(x, minX, _CMP_GE_OQ);
+        x = _mm512_max_ps(x, minX);
+        __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(ln2Hi), x);
+        r = _mm512_fnmadd_ps(n, _mm512_set1_ps(ln2Lo), r);
+        __m512 p = _mm512_set1_ps(expP0);
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expP1));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expP2));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expP3));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expP4));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expP5));
+        p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+        return _mm512_maskz_scalef_ps(inRange, p, n);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void BilateralKernel::filterRowsAvx2(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow) const
+{
+    constexpr int lanes = 8;
+    const int width = source.width();
+    const int height = source.height();
+    const uint8_t* valid = source.validMask();
+    const float* in[OrganizedPointCloud::ChannelCount];
+    float* out[OrganizedPointCloud::ChannelCount];
+    for (int k = 0; k < OrganizedPointCloud::ChannelCount; ++k) {
+        in[k] = source.channel(k);
+        out[k] = target.channel(k);
+    }
+    const __m256 scale = _mm256_set1_ps(rangeExponentScale);
+    const __m256 zero = _mm256_setzero_ps();
+
+    for (int x = firstRow; x < lastRow; ++x) {
+        //first and last point of a row need the column bound checks, the blocks in between do not
+        filterPointsScalar(source, target, x, 0, std::min(1, height));
+        int y = 1;
+        for (; y + lanes <= height - 1; y += lanes) {
+            const size_t p = source.index(x, y);
+            const __m256 centerValid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+                    _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(valid + p))), _mm256_setzero_si256()));
+            const __m256 cnx = _mm256_loadu_ps(in[3] + p);
+            const __m256 cny = _mm256_loadu_ps(in[4] + p);
+            const __m256 cnz = _mm256_loadu_ps(in[5] + p);
+            __m256 sum[6] = {zero, zero, zero, zero, zero, zero};
+            __m256 weightSum = zero;
+
+            for (int i = -1; i <= 1; ++i) {
+                if (x + i < 0 || x + i >= width) continue;
+                for (int j = -1; j <= 1; ++j) {
+                    if (i == 0 && j == 0) continue;
+                    const size_t q = p + static_cast<ptrdiff_t>(i) * height + j;
+                    const __m256 neighborValid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+                            _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(valid + q))), _mm256_setzero_si256()));
+                    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(in[3] + q), cnx);
+                    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(in[4] + q), cny);
+                    __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(in[5] + q), cnz);
+                    __m256 distance2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+                    __m256 weight = _mm256_mul_ps(exp256(_mm256_mul_ps(scale, distance2)), _mm256_set1_ps(combinedWeights[i + 1][j + 1]));
+                    weight = _mm256_and_ps(weight, neighborValid);
+                    weightSum = _mm256_add_ps(weightSum, weight);
+                    for (int k = 0; k < 6; ++k) {
+                        //invalid neighbors hold NaN, clear them before they reach the sum
+                        __m256 value = _mm256_and_ps(_mm256_loadu_ps(in[k] + q), neighborValid);
+                        sum[k] = _mm256_fmadd_ps(value, weight, sum[k]);
+                    }
+                }
+            }
+            const __m256 update = _mm256_and_ps(centerValid, _mm256_cmp_ps(weightSum, zero, _CMP_GT_OQ));
+            for (int k = 0; k < 6; ++k) {
+                __m256 filtered = _mm256_div_ps(sum[k], weightSum);
+                _mm256_storeu_ps(out[k] + p, _mm256_blendv_ps(_mm256_loadu_ps(in[k] + p), filtered, update));
+            }
+        }
+        filterPointsScalar(source, target, x, y, height);
+    }
+}
+
+__attribute__((target("avx512f")))
+void BilateralKernel::filterRowsAvx512(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow) const
+{
+    constexpr int lanes = 16;
+    const int width = source.width();
+    const int height = source.height();
+    const uint8_t* valid = source.validMask();
+    const float* in[OrganizedPointCloud::ChannelCount];
+    float* out[OrganizedPointCloud::ChannelCount];
+    for (int k = 0; k < OrganizedPointCloud::ChannelCount; ++k) {
+        in[k] = source.channel(k);
+        out[k] = target.channel(k);
+    }
+    const __m512 scale = _mm512_set1_ps(rangeExponentScale);
+    const __m512 zero = _mm512_setzero_ps();
+
+    for (int x = firstRow; x < lastRow; ++x) {
+        filterPointsScalar(source, target, x, 0, std::min(1, height));
+        int y = 1;
+        for (; y + lanes <= height - 1; y += lanes) {
+            const size_t p = source.index(x, y);
+            const __m512i centerMask = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(valid + p)));
+            const __mmask16 centerValid = _mm512_test_epi32_mask(centerMask, centerMask);
+            const __m512 cnx = _mm512_loadu_ps(in[3] + p);
+            const __m512 cny = _mm512_loadu_ps(in[4] + p);
+            const __m512 cnz = _mm512_loadu_ps(in[5] + p);
+            __m512 sum[6] = {zero, zero, zero, zero, zero, zero};
+            __m512 weightSum = zero;
+
+            for (int i = -1; i <= 1; ++i) {
+                if (x + i < 0 || x + i >= width) continue;
+                for (int j = -1; j <= 1; ++j) {
+                    if (i == 0 && j == 0) continue;
+                    const size_t q = p + static_cast<ptrdiff_t>(i) * height + j;
+                    const __m512i neighborMask = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(valid + q)));
+                    const __mmask16 neighborValid = _mm512_test_epi32_mask(neighborMask, neighborMask);
+                    __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(in[3] + q), cnx);
+                    __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(in[4] + q), cny);
+                    __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(in[5] + q), cnz);
+                    __m512 distance2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+                    __m512 weight = _mm512_maskz_mul_ps(neighborValid, exp512(_mm512_mul_ps(scale, distance2)),
+                                                        _mm512_set1_ps(combinedWeights[i + 1][j + 1]));
+                    weightSum = _mm512_add_ps(weightSum, weight);
+                    for (int k = 0; k < 6; ++k) {
+                        //masked lanes keep the sum, so NaN of invalid neighbors never enters it
+                        sum[k] = _mm512_mask3_fmadd_ps(_mm512_loadu_ps(in[k] + q), weight, sum[k], neighborValid);
+                    }
+                }
+            }
+            const __mmask16 update = centerValid & _mm512_cmp_ps_mask(weightSum, zero, _CMP_GT_OQ);
+            for (int k = 0; k < 6; ++k) {
+                __m512 filtered = _mm512_div_ps(sum[k], weightSum);
+                _mm512_storeu_ps(out[k] + p, _mm512_mask_blend_ps(update, _mm512_loadu_ps(in[k] + p), filtered));
+            }
+        }
+        filterPointsScalar(source, target, x, y, height);
+    }
+}
+
+namespace {
+    //all-ones lanes for the 8 validity bits starting at bit p, the spare word covers the last block
+    __attribute__((target("avx2,fma")))
+    inline __m256 validLanes(const uint64_t* bits, size_t p)
+    {
+        const unsigned shift = p & 63;
+        uint64_t value = bits[p >> 6] >> shift;
+        if (shift > 56) value |= bits[(p >> 6) + 1] << (64 - shift);
+        const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        const __m256i lanes = _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(value & 0xFF)), laneBits);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(lanes, laneBits));
+    }
+
+    //CompactPointCloud::decodeNormal of 8 packed normals
+    __attribute__((target("avx2,fma")))
+    inline void decodeNormals(__m256i packed, __m256& nx, __m256& ny, __m256& nz)
+    {
+        const __m256 snorm = _mm256_set1_ps(1.0f / 32767.0f);
+        const __m256 signBit = _mm256_set1_ps(-0.0f);
+        __m256 x = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(packed, 16), 16)), snorm);
+        __m256 y = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(packed, 16)), snorm);
+        __m256 z = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_andnot_ps(signBit, x)), _mm256_andnot_ps(signBit, y));
+        const __m256 t = _mm256_max_ps(_mm256_sub_ps(_mm256_setzero_ps(), z), _mm256_setzero_ps());
+        //snorm values are never -0, so the sign bit is the x >= 0 test of the scalar decode
+        x = _mm256_sub_ps(x, _mm256_or_ps(t, _mm256_and_ps(x, signBit)));
+        y = _mm256_sub_ps(y, _mm256_or_ps(t, _mm256_and_ps(y, signBit)));
+        //rsqrt with one Newton step, about 2e-7 relative instead of a sqrt and a division
+        const __m256 length2 = _mm256_fmadd_ps(x, x, _mm256_fmadd_ps(y, y, _mm256_mul_ps(z, z)));
+        const __m256 estimate = _mm256_rsqrt_ps(length2);
+        const __m256 inverseLength = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), estimate),
+                                                   _mm256_fnmadd_ps(_mm256_mul_ps(length2, estimate), estimate, _mm256_set1_ps(3.0f)));
+        nx = _mm256_mul_ps(x, inverseLength);
+        ny = _mm256_mul_ps(y, inverseLength);
+        nz = _mm256_mul_ps(z, inverseLength);
+    }
+
+    //decodes count packed normals into three component planes
+    __attribute__((target("avx2,fma")))
+    void decodeNormalRow(const uint32_t* packed, int count, float* nx, float* ny, float* nz)
+    {
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 x, y, z;
+            decodeNormals(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(packed + i)), x, y, z);
+            _mm256_storeu_ps(nx + i, x);
+            _mm256_storeu_ps(ny + i, y);
+            _mm256_storeu_ps(nz + i, z);
+        }
+        for (; i < count; ++i) {
+            CompactPointCloud::decodeNormal(packed[i], nx[i], ny[i], nz[i]);
+        }
+    }
+
+    //CompactPointCloud::encodeNormal of 8 normals
+    __attribute__((target("avx2,fma")))
+    inline __m256i encodeNormals(__m256 nx, __m256 ny, __m256 nz)
+    {
+        const __m256 signBit = _mm256_set1_ps(-0.0f);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 l1 = _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(signBit, nx), _mm256_andnot_ps(signBit, ny)), _mm256_andnot_ps(signBit, nz));
+        const __m256 nonZero = _mm256_cmp_ps(l1, zero, _CMP_GT_OQ);
+        __m256 x = _mm256_div_ps(nx, l1), y = _mm256_div_ps(ny, l1);
+        const __m256 fx = _mm256_sub_ps(one, _mm256_andnot_ps(signBit, y));
+        const __m256 fy = _mm256_sub_ps(one, _mm256_andnot_ps(signBit, x));
+        const __m256 foldedX = _mm256_blendv_ps(_mm256_xor_ps(fx, signBit), fx, _mm256_cmp_ps(x, zero, _CMP_GE_OQ));
+        const __m256 foldedY = _mm256_blendv_ps(_mm256_xor_ps(fy, signBit), fy, _mm256_cmp_ps(y, zero, _CMP_GE_OQ));
+        const __m256 lower = _mm256_cmp_ps(nz, zero, _CMP_LT_OQ);
+        x = _mm256_and_ps(_mm256_blendv_ps(x, foldedX, lower), nonZero);
+        y = _mm256_and_ps(_mm256_blendv_ps(y, foldedY, lower), nonZero);
+        const __m256 scale = _mm256_set1_ps(32767.0f);
+        const __m256i ix = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(one, _mm256_max_ps(_mm256_xor_ps(one, signBit), x)), scale));
+        const __m256i iy = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(one, _mm256_max_ps(_mm256_xor_ps(one, signBit), y)), scale));
+        return _mm256_or_si256(_mm256_and_si256(ix, _mm256_set1_epi32(0xFFFF)), _mm256_slli_epi32(iy, 16));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void BilateralKernel::filterCompactAvx2(const CompactPointCloud& source, CompactPointCloud& target, int firstRow, int lastRow, float* decoded) const
+{
+    constexpr int lanes = 8;
+    const int width = source.width();
+    const int height = source.height();
+    const float* inDepth = source.depth();
+    const uint32_t* inNormal = source.normals();
+    const uint64_t* valid = source.validBits();
+    float* outDepth = target.depth();
+    uint32_t* outNormal = target.normals();
+    const __m256 scale = _mm256_set1_ps(rangeExponentScale);
+    const __m256 zero = _mm256_setzero_ps();
+
+    //every row is decoded once into one of three row buffers of decoded, instead of once per neighbor that reads it
+    int decodedRow[3] = {-1, -1, -1};
+    auto decodeRow = [&](int row) -> const float* {
+        const int slot = row % 3;
+        float* out = decoded + static_cast<size_t>(slot) * 3 * height;
+        if (decodedRow[slot] == row) return out;
+        decodedRow[slot] = row;
+        decodeNormalRow(inNormal + source.index(row, 0), height, out, out + height, out + 2 * height);
+        return out;
+    };
+
+    for (int x = firstRow; x < lastRow; ++x) {
+        const float* rows[3];
+        for (int i = -1; i <= 1; ++i) {
+            rows[i + 1] = x + i >= 0 && x + i < width ? decodeRow(x + i) : nullptr;
+        }
+        filterCompactScalar(source, target, x, 0, std::min(1, height));
+        int y = 1;
+        for (; y + lanes <= height - 1; y += lanes) {
+            const size_t p = source.index(x, y);
+            const __m256 centerValid = validLanes(valid, p);
+            const __m256 cnx = _mm256_loadu_ps(rows[1] + y);
+            const __m256 cny = _mm256_loadu_ps(rows[1] + height + y);
+            const __m256 cnz = _mm256_loadu_ps(rows[1] + 2 * height + y);
+            __m256 sumDepth = zero, sumX = zero, sumY = zero, sumZ = zero;
+            __m256 weightSum = zero;
+
+            for (int i = -1; i <= 1; ++i) {
+                if (!rows[i + 1]) continue;
+                for (int j = -1; j <= 1; ++j) {
+                    if (i == 0 && j == 0) continue;
+                    const size_t q = p + static_cast<ptrdiff_t>(i) * height + j;
+                    const float* row = rows[i + 1] + y + j;
+                    const __m256 nx = _mm256_loadu_ps(row);
+                    const __m256 ny = _mm256_loadu_ps(row + height);
+                    const __m256 nz = _mm256_loadu_ps(row + 2 * height);
+                    __m256 dx = _mm256_sub_ps(nx, cnx);
+                    __m256 dy = _mm256_sub_ps(ny, cny);
+                    __m256 dz = _mm256_sub_ps(nz, cnz);
+                    __m256 distance2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+                    __m256 weight = _mm256_mul_ps(exp256(_mm256_mul_ps(scale, distance2)), _mm256_set1_ps(combinedWeights[i + 1][j + 1]));
+                    weight = _mm256_and_ps(weight, validLanes(valid, q));
+                    weightSum = _mm256_add_ps(weightSum, weight);
+                    //invalid points hold 0 and a decodable normal, the zero weight is enough to drop them
+                    sumDepth = _mm256_fmadd_ps(_mm256_loadu_ps(inDepth + q), weight, sumDepth);
+                    sumX = _mm256_fmadd_ps(nx, weight, sumX);
+                    sumY = _mm256_fmadd_ps(ny, weight, sumY);
+                    sumZ = _mm256_fmadd_ps(nz, weight, sumZ);
+                }
+            }
+            const __m256 update = _mm256_and_ps(centerValid, _mm256_cmp_ps(weightSum, zero, _CMP_GT_OQ));
+            const __m256i centerNormal = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inNormal + p));
+            const __m256 depth = _mm256_blendv_ps(_mm256_loadu_ps(inDepth + p), _mm256_div_ps(sumDepth, weightSum), update);
+            const __m256i normal = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(centerNormal),
+                                                                        _mm256_castsi256_ps(encodeNormals(sumX, sumY, sumZ)), update));
+            _mm256_storeu_ps(outDepth + p, depth);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(outNormal + p), normal);
+        }
+        filterCompactScalar(source, target, x, y, height);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void WideBilateralKernel::filterRowsAvx2(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow, const std::vector<Offset>& offsets) const
+{
+    constexpr int lanes = 8;
+    const int width = source.width();
+    const int height = source.height();
+    const uint8_t* valid = source.validMask();
+    const float* in[OrganizedPointCloud::ChannelCount];
+    float* out[OrganizedPointCloud::ChannelCount];
+    for (int k = 0; k < OrganizedPointCloud::ChannelCount; ++k) {
+        in[k] = source.channel(k);
+        out[k] = target.channel(k);
+    }
+    //blocks whose neighbors all lie inside the row, the points before and after them are filtered scalar
+    int reach = 0;
+    for (const Offset& offset : offsets) reach = std::max(reach, std::abs(offset.dy));
+    const __m256 distanceScale = _mm256_set1_ps(distanceExponentScale);
+    const __m256 normalScale = _mm256_set1_ps(normalExponentScale);
+    const __m256 zero = _mm256_setzero_ps();
+
+    for (int x = firstRow; x < lastRow; ++x) {
+        filterPointsScalar(source, target, x, 0, std::min(reach, height), offsets);
+        int y = reach;
+        for (; y + lanes <= height - reach; y += lanes) {
+            const size_t p = source.index(x, y);
+            const __m256 centerValid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+                    _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(valid + p))), _mm256_setzero_si256()));
+            __m256 center[6];
+            for (int k = 0; k < 6; ++k) center[k] = _mm256_loadu_ps(in[k] + p);
+            __m256 sum[6] = {zero, zero, zero, zero, zero, zero};
+            __m256 weightSum = zero;
+
+            for (const Offset& offset : offsets) {
+                if (x + offset.dx < 0 || x + offset.dx >= width) continue;
+                const size_t q = p + static_cast<ptrdiff_t>(offset.dx) * height + offset.dy;
+                const __m256 neighborValid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+                        _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(valid + q))), _mm256_setzero_si256()));
+                __m256 value[6];
+                for (int k = 0; k < 6; ++k) value[k] = _mm256_loadu_ps(in[k] + q);
+                __m256 distance2 = zero, normal2 = zero;
+                for (int k = 0; k < 3; ++k) {
+                    __m256 d = _mm256_sub_ps(value[k], center[k]);
+                    __m256 n = _mm256_sub_ps(value[k + 3], center[k + 3]);
+                    distance2 = _mm256_fmadd_ps(d, d, distance2);
+                    normal2 = _mm256_fmadd_ps(n, n, normal2);
+                }
+                __m256 exponent = _mm256_fmadd_ps(distanceScale, distance2, _mm256_mul_ps(normalScale, normal2));
+                __m256 weight = _mm256_mul_ps(exp256(exponent), _mm256_set1_ps(offset.weight));
+                weight = _mm256_and_ps(weight, neighborValid);
+                weightSum = _mm256_add_ps(weightSum, weight);
+                for (int k = 0; k < 6; ++k) {
+                    //invalid neighbors hold NaN, clear them before they reach the sum
+                    sum[k] = _mm256_fmadd_ps(_mm256_and_ps(value[k], neighborValid), weight, sum[k]);
+                }
+            }
+            const __m256 update = _mm256_and_ps(centerValid, _mm256_cmp_ps(weightSum, zero, _CMP_GT_OQ));
+            for (int k = 0; k < 6; ++k) {
+                __m256 filtered = _mm256_div_ps(sum[k], weightSum);
+                _mm256_storeu_ps(out[k] + p, _mm256_blendv_ps(center[k], filtered, update));
+            }
+        }
+        filterPointsScalar(source, target, x, y, height, offsets);
+    }
+}
+
+#else
+
+void BilateralKernel::filterCompactAvx2(const CompactPointCloud& source, CompactPointCloud& target, int firstRow, int lastRow, float* decoded) const
+{
+    for (int x = firstRow; x < lastRow; ++x) {
+        filterCompactScalar(source, target, x, 0, source.height());
+    }
+}
+
+void BilateralKernel::filterRowsAvx2(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow) const
+{
+    filterRowsScalar(source, target, firstRow, lastRow);
+}
+
+void BilateralKernel::filterRowsAvx512(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow) const
+{
+    filterRowsScalar(source, target, firstRow, lastRow);
+}
+
+void WideBilateralKernel::filterRowsAvx2(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow, const std::vector<Offset>& offsets) const
+{
+    for (int x = firstRow; x < lastRow; ++x) {
+        filterPointsScalar(source, target, x, 0, source.height(), offsets);
+    }
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef BILATERALKERNEL_H
+#define BILATERALKERNEL_H
+
+#include <vector>
+#include "OrganizedPointCloud.h"
+
+class CompactPointCloud;
+
+//8-neighbor bilateral kernel over an organized point cloud.
+//The spatial weight only depends on the neighbor offset, so the 3x3 table is computed once per sigma pair.
+//The scalar path reproduces the original filter bit for bit. The AVX2 (8 points) and AVX-512 (16 points)
+//paths process consecutive points of a row per lane, skip the sqrt of the normal difference and use a
+//polynomial exp for the range weight. Against the scalar path each weight differs by at most 4e-7
+//relative, which bounds the error of a filtered value to about 1e-6 of the spread of its neighborhood.
+//Weights that would fall below FLT_MIN are flushed to zero.
+//The scalar point loop is templated on the accumulator of the weighted sums. float is the original filter,
+//double runs scalar only. The 3x3 neighborhood has constant bounds, so the neighbor loops unroll completely.
+class BilateralKernel {
+public:
+    enum class Isa { Scalar, Avx2, Avx512 };
+
+    BilateralKernel(float spatialSigma, float rangeSigma, bool vectorized = true, bool doubleAccumulator = false);
+    //best instruction set supported by the running CPU
+    static Isa detectIsa();
+    Isa isa() const { return selectedIsa; }
+    const char* isaName() const;
+
+    //filters points of rows [firstRow, lastRow) from source into target
+    void filterRows(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow) const;
+    //the same weights on the depth and the decoded normals of a compact cloud, normals are encoded again at the
+    //store. target must already hold the layout of source, the vector paths use AVX2 and decode rows into
+    //rowBuffer, which holds compactRowBufferSize(source.height()) floats.
+    void filterRows(const CompactPointCloud& source, CompactPointCloud& target, int firstRow, int lastRow, float* rowBuffer) const;
+    static size_t compactRowBufferSize(int height) { return static_cast<size_t>(9) * height; }
+
+private:
+    void filterRowsScalar(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow) const;
+    void filterRowsAvx2(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow) const;
+    void filterRowsAvx512(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow) const;
+    //scalar filtering of the points [firstCol, lastCol) of one row, used for the row ends of the vector paths
+    void filterPointsScalar(const OrganizedPointCloud& source, OrganizedPointCloud& target, int x, int firstCol, int lastCol) const;
+    template<typename Accumulator>
+    void filterPoints(const OrganizedPointCloud& source, OrganizedPointCloud& target, int x, int firstCol, int lastCol) const;
+
+    void filterCompactAvx2(const CompactPointCloud& source, CompactPointCloud& target, int firstRow, int lastRow, float* decoded) const;
+    void filterCompactScalar(const CompactPointCloud& source, CompactPointCloud& target, int x, int firstCol, int lastCol) const;
+
+    float gaussian(float x, float sigma) const;
+
+    float rangeSigma;
+    float spatialWeights[3][3];
+    //spatial weight times the normalisation of the range gaussian, used by the vector paths
+    float combinedWeights[3][3];
+    float rangeExponentScale;//-0.5 / rangeSigma^2
+    Isa selectedIsa;
+    bool doubleAccumulator;
+};
+
+//Bilateral kernel over a (2 * radius + 1)^2 window of an organized point cloud, the center included.
+//A neighbor is weighted by its grid distance (spatialSigma, in points), its 3D distance to the center
+//(distanceSigma, 0 ignores it) and the difference of the normals (normalSigma), the two range terms share one exp.
+//The offsets of every pass and their spatial weights are tabulated once. Full visits the whole window,
+//AlongY and AlongX one line of it, so a separable pair of passes costs 4 * radius + 2 neighbors per point
+//instead of (2 * radius + 1)^2. The pair is the usual separable approximation of the full window, the range
+//weights of the second pass are taken on the output of the first.
+//The AVX2 path processes 8 consecutive points of a row with the polynomial exp of BilateralKernel.
+class WideBilateralKernel {
+public:
+    enum class Pass { Full, AlongY, AlongX };
+
+    WideBilateralKernel(int radius, float spatialSigma, float distanceSigma, float normalSigma, bool vectorized = true);
+    int radius() const { return windowRadius; }
+    bool isVectorized() const { return useAvx2; }
+
+    //filters points of rows [firstRow, lastRow) from source into target with the offsets of pass
+    void filterRows(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow, Pass pass) const;
+
+private:
+    struct Offset {
+        int dx, dy;
+        float weight;
+    };
+    void filterRowsAvx2(const OrganizedPointCloud& source, OrganizedPointCloud& target, int firstRow, int lastRow, const std::vector<Offset>& offsets) const;
+    void filterPointsScalar(const OrganizedPointCloud& source, OrganizedPointCloud& target, int x, int firstCol, int lastCol, const std::vector<Offset>& offsets) const;
+
+    int windowRadius;
+    float distanceExponentScale;//-0.5 / distanceSigma^2, 0 without distance term
+    float normalExponentScale;//-0.5 / normalSigma^2
+    std::vector<Offset> fullOffsets;
+    std::vector<Offset> yOffsets;
+    std::vector<Offset> xOffsets;
+    bool useAvx2;
+};
+
+#endif // BILATERALKERNEL_H
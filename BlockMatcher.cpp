@@ -0,0 +1,187 @@
+#include "BlockMatcher.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include "Trace.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define KIVI_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+BlockMatcher::BlockMatcher(int blockSize, int maxDisparity, bool vectorized)
+        : blockSize(std::max(1, blockSize | 1)), maxDisparity(std::max(0, maxDisparity)), useAvx2(false)
+{
+#ifdef KIVI_X86_SIMD
+    useAvx2 = vectorized && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    (void)vectorized;
+#endif
+}
+
+void BlockMatcher::accumulateAbsDiff(const float* left, const float* right, double* sums, int* invalid, int count, int weight) const
+{
+    if (useAvx2) {
+        accumulateAbsDiffAvx2(left, right, sums, invalid, count, weight);
+        return;
+    }
+    for (int i = 0; i < count; ++i) {
+        const float difference = std::abs(left[i] - right[i]);
+        if (invalid && !std::isfinite(difference)) invalid[i] += weight;
+        else sums[i] += weight * difference;
+    }
+}
+
+#ifdef KIVI_X86_SIMD
+
+__attribute__((target("avx2,fma")))
+void BlockMatcher::accumulateAbsDiffAvx2(const float* left, const float* right, double* sums, int* invalid, int count, int weight) const
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    const __m256d weights = _mm256_set1_pd(weight);
+    const __m256i invalidWeights = _mm256_set1_epi32(weight);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 difference = _mm256_andnot_ps(signMask, _mm256_sub_ps(_mm256_loadu_ps(left + i), _mm256_loadu_ps(right + i)));
+        if (invalid) {
+            //NaN and infinity fail the ordered compare, they are counted and add 0
+            __m256 finite = _mm256_cmp_ps(difference, infinity, _CMP_LT_OQ);
+            difference = _mm256_and_ps(difference, finite);
+            __m256i counts = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(invalid + i));
+            counts = _mm256_add_epi32(counts, _mm256_andnot_si256(_mm256_castps_si256(finite), invalidWeights));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(invalid + i), counts);
+        }
+        //widening is exact, the double sums of the scalar path
+        __m256d low = _mm256_cvtps_pd(_mm256_castps256_ps128(difference));
+        __m256d high = _mm256_cvtps_pd(_mm256_extractf128_ps(difference, 1));
+        _mm256_storeu_pd(sums + i, _mm256_fmadd_pd(weights, low, _mm256_loadu_pd(sums + i)));
+        _mm256_storeu_pd(sums + i + 4, _mm256_fmadd_pd(weights, high, _mm256_loadu_pd(sums + i + 4)));
+    }
+    for (; i < count; ++i) {
+        const float difference = std::abs(left[i] - right[i]);
+        if (invalid && !std::isfinite(difference)) invalid[i] += weight;
+        else sums[i] += weight * difference;
+    }
+}
+
+#else
+
+void BlockMatcher::accumulateAbsDiffAvx2(const float* left, const float* right, double* sums, int* invalid, int count, int weight) const
+{
+    for (int i = 0; i < count; ++i) {
+        const float difference = std::abs(left[i] - right[i]);
+        if (invalid && !std::isfinite(difference)) invalid[i] += weight;
+        else sums[i] += weight * difference;
+    }
+}
+
+#endif
+
+void BlockMatcher::matchBand(const cv::Mat& left, const cv::Mat& right, int firstRow, int lastRow, cv::Mat& disparity) const
+{
+    const int width = left.cols;
+    const int half = blockSize / 2;
+    const int bandHeight = lastRow - firstRow;
+    //column sums of the block window for the current row and disparity, indexed by the left x
+    std::vector<double> columnSums(width);
+    std::vector<double> prefix(width + 1);
+    //non-finite pixels of the column window, and their prefix along the row
+    std::vector<int> columnInvalid(width);
+    std::vector<int> invalidPrefix(width + 1);
+    std::vector<float> bestCost(static_cast<size_t>(bandHeight) * width, std::numeric_limits<float>::max());
+    //most bands hold no masked pixel, they skip the invalid counts
+    bool anyInvalid = false;
+    for (int r = firstRow - half; r < lastRow + half && !anyInvalid; ++r) {
+        const float* leftRow = left.ptr<float>(r);
+        const float* rightRow = right.ptr<float>(r);
+        for (int x = 0; x < width; ++x) {
+            if (!std::isfinite(leftRow[x]) || !std::isfinite(rightRow[x])) {
+                anyInvalid = true;
+                break;
+            }
+        }
+    }
+    int* invalid = anyInvalid ? columnInvalid.data() : nullptr;
+
+    for (int y = firstRow; y < lastRow; ++y) {
+        float* row = disparity.ptr<float>(y);
+        std::fill(row, row + width, 0.0f);
+    }
+    for (int d = 0; d <= maxDisparity; ++d) {
+        //blocks need x - d - half >= 0 in the right image and x + half < width in the left one
+        const int firstCol = half + d;
+        const int lastCol = width - half;
+        if (firstCol >= lastCol) break;
+        //columns [d, width) take part, the right pixel of left column x is x - d
+        const int count = width - d;
+        std::fill(columnSums.begin(), columnSums.end(), 0.0);
+        std::fill(columnInvalid.begin(), columnInvalid.end(), 0);
+        for (int r = firstRow - half; r <= firstRow + half; ++r) {
+            accumulateAbsDiff(left.ptr<float>(r) + d, right.ptr<float>(r), columnSums.data() + d, invalid ? invalid + d : nullptr, count, 1);
+        }
+        for (int y = firstRow; y < lastRow; ++y) {
+            prefix[d] = 0.0;
+            for (int x = d; x < width; ++x) prefix[x + 1] = prefix[x] + columnSums[x];
+            if (invalid) {
+                invalidPrefix[d] = 0;
+                for (int x = d; x < width; ++x) invalidPrefix[x + 1] = invalidPrefix[x] + columnInvalid[x];
+            }
+            float* costs = bestCost.data() + static_cast<size_t>(y - firstRow) * width;
+            float* row = disparity.ptr<float>(y);
+            for (int x = firstCol; x < lastCol; ++x) {
+                if (invalid && invalidPrefix[x + half + 1] != invalidPrefix[x - half]) continue;
+                const float cost = static_cast<float>(prefix[x + half + 1] - prefix[x - half]);
+                if (cost < costs[x]) {
+                    costs[x] = cost;
+                    row[x] = static_cast<float>(d);
+                }
+            }
+            if (y + 1 < lastRow) {
+                //slide the window one row down
+                accumulateAbsDiff(left.ptr<float>(y + half + 1) + d, right.ptr<float>(y + half + 1), columnSums.data() + d,
+                                  invalid ? invalid + d : nullptr, count, 1);
+                accumulateAbsDiff(left.ptr<float>(y - half) + d, right.ptr<float>(y - half), columnSums.data() + d,
+                                  invalid ? invalid + d : nullptr, count, -1);
+            }
+        }
+    }
+    for (int y = firstRow; y < lastRow && anyInvalid; ++y) {
+        const float* leftRow = left.ptr<float>(y);
+        float* row = disparity.ptr<float>(y);
+        for (int x = 0; x < width; ++x) {
+            if (!std::isfinite(leftRow[x])) row[x] = std::numeric_limits<float>::quiet_NaN();
+        }
+    }
+}
+
+void BlockMatcher::match(const cv::Mat& left, const cv::Mat& right, cv::Mat& disparity) const
+{
+    KIVI_TRACE_SCOPE("BlockMatcher::match");
+    KIVI_TRACE_COUNT("disparity_pixels", static_cast<int64_t>(left.total()));
+    if (left.size() != right.size() || left.type() != right.type()
+        || (left.type() != CV_32FC1 && left.type() != CV_64FC1)) {
+        std::cerr << "Block matching needs single channel float or double images of the same size" << std::endl;
+        disparity.release();
+        return;
+    }
+    cv::Mat leftFloat = left, rightFloat = right;
+    if (left.type() == CV_64FC1) {
+        left.convertTo(leftFloat, CV_32F);
+        right.convertTo(rightFloat, CV_32F);
+    }
+    disparity.create(left.rows, left.cols, CV_32FC1);
+    disparity.setTo(0.0f);
+    const int half = blockSize / 2;
+    const int firstRow = half, lastRow = left.rows - half;
+    if (firstRow >= lastRow) return;
+    const int bands = (lastRow - firstRow + bandRows - 1) / bandRows;
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+        for (int band = range.start; band < range.end; ++band) {
+            const int bandFirst = firstRow + band * bandRows;
+            matchBand(leftFloat, rightFloat, bandFirst, std::min(lastRow, bandFirst + bandRows), disparity);
+        }
+    });
+}
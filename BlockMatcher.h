@@ -0,0 +1,37 @@
+#ifndef BLOCKMATCHER_H
+#define BLOCKMATCHER_H
+
+#include <opencv2/opencv.hpp>
+
+//Sum of absolute differences block matching as a cost volume.
+//For one disparity at a time the absolute differences are summed down the columns with a sliding window
+//and across the row through a prefix sum, so a block cost takes the same time for every block size.
+//Only the running column sums, one prefix row and the best cost so far are kept, the volume is never stored.
+//Column sums and the prefix are double, so sliding the window down a band adds and removes the float
+//differences without drift and a cost differs from the direct sum only by double rounding.
+//Row bands are matched in parallel. Results follow the brute-force search: the lowest cost wins, ties go to
+//the smaller disparity, disparity x - d must keep the block inside the right image and pixels closer than
+//half a block to the image border stay 0.
+//NaN or infinite pixels, e.g. masked phase, add nothing to the sums but are counted per column, and a block
+//that holds one is never chosen. A non-finite left pixel gets a NaN disparity.
+class BlockMatcher {
+public:
+    BlockMatcher(int blockSize = 5, int maxDisparity = 64, bool vectorized = true);
+
+    //left and right are CV_32FC1 or CV_64FC1 of the same size, disparity becomes CV_32FC1
+    void match(const cv::Mat& left, const cv::Mat& right, cv::Mat& disparity) const;
+
+private:
+    void matchBand(const cv::Mat& left, const cv::Mat& right, int firstRow, int lastRow, cv::Mat& disparity) const;
+    //sums[i] += weight * |left[i] - right[i]|, the difference in float and the sum in double.
+    //A non-finite difference adds weight to invalid[i] instead, a null invalid means every input is finite.
+    void accumulateAbsDiff(const float* left, const float* right, double* sums, int* invalid, int count, int weight) const;
+    void accumulateAbsDiffAvx2(const float* left, const float* right, double* sums, int* invalid, int count, int weight) const;
+
+    int blockSize, maxDisparity;
+    bool useAvx2;
+    //output rows per parallel task, large enough to hide the block tall window that every band starts with
+    static const int bandRows = 64;
+};
+
+#endif // BLOCKMATCHER_H
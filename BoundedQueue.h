@@ -0,0 +1,73 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+//Blocking queue of fixed capacity for any number of producer and consumer threads.
+//push waits while the queue is full, which is how a slow consumer slows its producers down.
+//The storage is a ring allocated once, pushing and popping never allocates.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+            : slots(capacity > 0 ? capacity : 1) {}
+
+    //false once the queue is closed
+    bool push(const T& value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return count < slots.size() || closed; });
+        if (closed) return false;
+        slots[(head + count) % slots.size()] = value;
+        ++count;
+        notEmpty.notify_one();
+        return true;
+    }
+
+    //false when the queue is closed and drained
+    bool pop(T& value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&] { return count > 0 || closed; });
+        if (count == 0) return false;
+        value = slots[head];
+        head = (head + 1) % slots.size();
+        --count;
+        notFull.notify_one();
+        return true;
+    }
+
+    //wakes every waiting thread, queued items can still be popped
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    //reopens an empty queue for the next batch
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        head = 0;
+        count = 0;
+        closed = false;
+    }
+
+    size_t capacity() const { return slots.size(); }
+
+private:
+    std::vector<T> slots;
+    size_t head = 0;
+    size_t count = 0;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+#endif // BOUNDEDQUEUE_H
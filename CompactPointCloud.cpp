@@ -0,0 +1,202 @@
+#include "CompactPointCloud.h"
+#include <bitset>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "MappedFile.h"
+#include "Trace.h"
+
+namespace {
+    const char compactMagic[4] = {'K', 'P', 'C', 'L'};
+    const uint32_t compactVersion = 1;
+    const size_t compactAlignment = 64;
+
+    struct CompactHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        float fx, fy, cx, cy, baseline;
+        uint32_t flags;
+        uint64_t depthOffset;
+        uint64_t normalOffset;
+        uint64_t maskOffset;
+    };
+    static_assert(sizeof(CompactHeader) == 64, "compact cloud header must stay 64 bytes");
+
+    size_t alignUp(size_t value)
+    {
+        return (value + compactAlignment - 1) & ~(compactAlignment - 1);
+    }
+
+    bool writeAt(std::ofstream& out, size_t& position, size_t offset, const void* data, size_t bytes)
+    {
+        static const char zeros[compactAlignment] = {};
+        out.write(zeros, static_cast<std::streamsize>(offset - position));
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+        position = offset + bytes;
+        return static_cast<bool>(out);
+    }
+}
+
+CompactPointCloud::CompactPointCloud(int width, int height)
+{
+    resize(width, height);
+}
+
+void CompactPointCloud::resize(int width, int height)
+{
+    cloudWidth = width;
+    cloudHeight = height;
+    depthPlane.resize(size());
+    normalPlane.resize(size());
+    validWords.resize(size() / 64 + 2);
+}
+
+void CompactPointCloud::swap(CompactPointCloud& other) noexcept
+{
+    depthPlane.swap(other.depthPlane);
+    normalPlane.swap(other.normalPlane);
+    validWords.swap(other.validWords);
+    std::swap(cameraIntrinsics, other.cameraIntrinsics);
+    std::swap(cloudWidth, other.cloudWidth);
+    std::swap(cloudHeight, other.cloudHeight);
+}
+
+void CompactPointCloud::copyLayoutFrom(const CompactPointCloud& other)
+{
+    if (this == &other) return;
+    resize(other.width(), other.height());
+    validWords = other.validWords;
+    cameraIntrinsics = other.cameraIntrinsics;
+}
+
+void CompactPointCloud::setValid(size_t i, bool valid)
+{
+    const uint64_t bit = uint64_t(1) << (i & 63);
+    if (valid) validWords[i >> 6] |= bit;
+    else validWords[i >> 6] &= ~bit;
+}
+
+size_t CompactPointCloud::validCount() const
+{
+    size_t count = 0;
+    for (uint64_t word : validWords) count += std::bitset<64>(word).count();
+    return count;
+}
+
+size_t CompactPointCloud::memoryFootprint() const
+{
+    return depthPlane.size() * sizeof(float) + normalPlane.size() * sizeof(uint32_t) + validWords.size() * sizeof(uint64_t);
+}
+
+void CompactPointCloud::fromCloud(const OrganizedPointCloud& cloud, const CameraIntrinsics& intrinsics)
+{
+    resize(cloud.width(), cloud.height());
+    cameraIntrinsics = intrinsics;
+    std::fill(validWords.begin(), validWords.end(), 0);
+    const float* z = cloud.channel(OrganizedPointCloud::Z);
+    const float* nx = cloud.channel(OrganizedPointCloud::NX);
+    const float* ny = cloud.channel(OrganizedPointCloud::NY);
+    const float* nz = cloud.channel(OrganizedPointCloud::NZ);
+    for (size_t i = 0; i < size(); ++i) {
+        if (!cloud.isValid(i) || !std::isfinite(z[i])) {
+            depthPlane[i] = 0.0f;
+            normalPlane[i] = 0;
+            continue;
+        }
+        depthPlane[i] = z[i];
+        normalPlane[i] = encodeNormal(nx[i], ny[i], nz[i]);
+        validWords[i >> 6] |= uint64_t(1) << (i & 63);
+    }
+}
+
+void CompactPointCloud::toCloud(OrganizedPointCloud& cloud) const
+{
+    cloud.resize(cloudWidth, cloudHeight);
+    for (int u = 0; u < cloudWidth; ++u) {
+        for (int v = 0; v < cloudHeight; ++v) {
+            const size_t i = index(u, v);
+            if (!isValid(i)) {
+                cloud.setInvalid(i);
+                continue;
+            }
+            const float z = depthPlane[i];
+            float nx, ny, nz;
+            decodeNormal(normalPlane[i], nx, ny, nz);
+            //same expressions as Triangulator, so triangulated x and y come back exactly
+            const float x = (static_cast<float>(u) - cameraIntrinsics.cx) * z / cameraIntrinsics.fx;
+            const float y = (static_cast<float>(v) - cameraIntrinsics.cy) * z / cameraIntrinsics.fy;
+            cloud.setPoint(i, x, y, z, nx, ny, nz);
+        }
+    }
+}
+
+bool CompactPointCloud::write(const std::string& filename) const
+{
+    KIVI_TRACE_SCOPE("CompactPointCloud::write");
+    CompactHeader header = {};
+    std::memcpy(header.magic, compactMagic, sizeof(compactMagic));
+    header.version = compactVersion;
+    header.width = static_cast<uint32_t>(cloudWidth);
+    header.height = static_cast<uint32_t>(cloudHeight);
+    header.fx = cameraIntrinsics.fx;
+    header.fy = cameraIntrinsics.fy;
+    header.cx = cameraIntrinsics.cx;
+    header.cy = cameraIntrinsics.cy;
+    header.baseline = cameraIntrinsics.baseline;
+    header.depthOffset = alignUp(sizeof(CompactHeader));
+    header.normalOffset = alignUp(header.depthOffset + size() * sizeof(float));
+    header.maskOffset = alignUp(header.normalOffset + size() * sizeof(uint32_t));
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return false;
+    }
+    size_t position = 0;
+    bool ok = writeAt(out, position, 0, &header, sizeof(header));
+    ok = ok && writeAt(out, position, header.depthOffset, depthPlane.data(), size() * sizeof(float));
+    ok = ok && writeAt(out, position, header.normalOffset, normalPlane.data(), size() * sizeof(uint32_t));
+    ok = ok && writeAt(out, position, header.maskOffset, validWords.data(), (size() + 63) / 64 * sizeof(uint64_t));
+    if (!ok) std::cerr << "Error writing file: " << filename << std::endl;
+    return ok;
+}
+
+bool CompactPointCloud::read(const std::string& filename)
+{
+    KIVI_TRACE_SCOPE("CompactPointCloud::read");
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return false;
+    }
+    CompactHeader header;
+    if (file.size() < sizeof(header)) {
+        std::cerr << "Not a compact point cloud file: " << filename << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, compactMagic, sizeof(compactMagic)) != 0 || header.version != compactVersion) {
+        std::cerr << "Not a compact point cloud file: " << filename << std::endl;
+        return false;
+    }
+    const size_t points = static_cast<size_t>(header.width) * header.height;
+    const size_t maskBytes = (points + 63) / 64 * sizeof(uint64_t);
+    if (header.depthOffset + points * sizeof(float) > file.size() || header.normalOffset + points * sizeof(uint32_t) > file.size()
+        || header.maskOffset + maskBytes > file.size()) {
+        std::cerr << "Truncated compact point cloud file: " << filename << std::endl;
+        return false;
+    }
+    resize(static_cast<int>(header.width), static_cast<int>(header.height));
+    cameraIntrinsics.fx = header.fx;
+    cameraIntrinsics.fy = header.fy;
+    cameraIntrinsics.cx = header.cx;
+    cameraIntrinsics.cy = header.cy;
+    cameraIntrinsics.baseline = header.baseline;
+    std::memcpy(depthPlane.data(), file.data() + header.depthOffset, points * sizeof(float));
+    std::memcpy(normalPlane.data(), file.data() + header.normalOffset, points * sizeof(uint32_t));
+    std::fill(validWords.begin(), validWords.end(), 0);
+    std::memcpy(validWords.data(), file.data() + header.maskOffset, maskBytes);
+    return true;
+}
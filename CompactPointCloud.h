@@ -0,0 +1,106 @@
+#ifndef COMPACTPOINTCLOUD_H
+#define COMPACTPOINTCLOUD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "OrganizedPointCloud.h"
+#include "Triangulator.h"
+
+//Organized point cloud of a pinhole camera in 8.125 bytes per point instead of 25.
+//Point (u, v) keeps only its depth, x and y follow from the grid and the intrinsics as (u - cx) * z / fx and
+//(v - cy) * z / fy. The unit normal is octahedral encoded into two signed 16-bit values (error below 1e-4 rad)
+//and validity is one bit per point, invalid points hold no NaN. The layout is the one of OrganizedPointCloud,
+//point (u, v) of the width x height grid is at index u * height + v.
+class CompactPointCloud {
+public:
+    CompactPointCloud() = default;
+    CompactPointCloud(int width, int height);
+
+    //contents are undefined after a size change
+    void resize(int width, int height);
+    //O(1) exchange of the planes, used for ping-pong iterations
+    void swap(CompactPointCloud& other) noexcept;
+    //takes the size, validity bits and intrinsics of other, depth and normals stay undefined
+    void copyLayoutFrom(const CompactPointCloud& other);
+    int width() const { return cloudWidth; }
+    int height() const { return cloudHeight; }
+    size_t size() const { return static_cast<size_t>(cloudWidth) * cloudHeight; }
+    bool empty() const { return size() == 0; }
+    size_t index(int u, int v) const { return static_cast<size_t>(u) * cloudHeight + v; }
+
+    const CameraIntrinsics& intrinsics() const { return cameraIntrinsics; }
+    void setIntrinsics(const CameraIntrinsics& intrinsics) { cameraIntrinsics = intrinsics; }
+
+    float* depth() { return depthPlane.data(); }
+    const float* depth() const { return depthPlane.data(); }
+    uint32_t* normals() { return normalPlane.data(); }
+    const uint32_t* normals() const { return normalPlane.data(); }
+    //bit i % 64 of word i / 64, one spare word lets 8 bits be read from any position
+    uint64_t* validBits() { return validWords.data(); }
+    const uint64_t* validBits() const { return validWords.data(); }
+    bool isValid(size_t i) const { return (validWords[i >> 6] >> (i & 63)) & 1; }
+    void setValid(size_t i, bool valid);
+    size_t validCount() const;
+    //bytes held by the planes and the bitmask
+    size_t memoryFootprint() const;
+
+    //keeps the depth and the normal of every valid point of a cloud on the pixel grid of intrinsics
+    void fromCloud(const OrganizedPointCloud& cloud, const CameraIntrinsics& intrinsics);
+    //x and y are recomputed from the depth, invalid points become NaN
+    void toCloud(OrganizedPointCloud& cloud) const;
+
+    //binary .kpc file: a 64 byte header, then the depth, normal and bitmask planes, each 64-byte aligned
+    bool write(const std::string& filename) const;
+    bool read(const std::string& filename);
+
+    //octahedral encoding, the normal does not need to be unit length, a zero normal encodes (0, 0, 1)
+    static uint32_t encodeNormal(float nx, float ny, float nz)
+    {
+        const float l1 = std::fabs(nx) + std::fabs(ny) + std::fabs(nz);
+        if (!(l1 > 0.0f)) return encodeOctahedral(0.0f, 0.0f);
+        float x = nx / l1, y = ny / l1;
+        if (nz < 0.0f) {
+            const float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            const float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+            x = fx;
+            y = fy;
+        }
+        return encodeOctahedral(x, y);
+    }
+
+    static void decodeNormal(uint32_t packed, float& nx, float& ny, float& nz)
+    {
+        float x = static_cast<int16_t>(packed & 0xFFFF) * (1.0f / 32767.0f);
+        float y = static_cast<int16_t>(packed >> 16) * (1.0f / 32767.0f);
+        const float z = 1.0f - std::fabs(x) - std::fabs(y);
+        const float t = std::max(-z, 0.0f);
+        x -= x >= 0.0f ? t : -t;
+        y -= y >= 0.0f ? t : -t;
+        const float inverseLength = 1.0f / std::sqrt(x * x + y * y + z * z);
+        nx = x * inverseLength;
+        ny = y * inverseLength;
+        nz = z * inverseLength;
+    }
+
+private:
+    static uint32_t encodeOctahedral(float x, float y)
+    {
+        const auto toSnorm = [](float value) {
+            return static_cast<uint32_t>(static_cast<uint16_t>(static_cast<int16_t>(std::lrint(std::min(1.0f, std::max(-1.0f, value)) * 32767.0f))));
+        };
+        return toSnorm(x) | (toSnorm(y) << 16);
+    }
+
+    std::vector<float> depthPlane;
+    std::vector<uint32_t> normalPlane;
+    std::vector<uint64_t> validWords;
+    CameraIntrinsics cameraIntrinsics;
+    int cloudWidth = 0;
+    int cloudHeight = 0;
+};
+
+#endif // COMPACTPOINTCLOUD_H
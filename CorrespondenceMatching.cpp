@@ -1,30 +1,57 @@
 #include "CorrespondenceMatching.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Trace.h"
 
+void CorrespondenceMatching::setMatchingMethod(MatchingMethod method) {
+    matchingMethod = method;
+}
+void CorrespondenceMatching::setDisparityRange(float minDisparity, float maxDisparity) {
+    phaseMatcher = PhaseMatcher(minDisparity, maxDisparity);
+}
+void CorrespondenceMatching::setBlockMatching(int blockSize, int maxDisparity) {
+    blockMatcher = BlockMatcher(blockSize, maxDisparity);
+}
+void CorrespondenceMatching::setHeadless(bool enabled) {
+    headless = enabled;
+}
+void CorrespondenceMatching::setArena(FrameArena* scratch) {
+    arena = scratch;
+}
 cv::Mat CorrespondenceMatching::readPhaseMap(const std::string& filename) {
-    std::ifstream file(filename);
-    std::vector<std::vector<double>> matrix;
-    std::string line, value;
-
-    while (getline(file, line)) {
-        std::stringstream ss(line);
-        std::vector<double> row;
-        while (getline(ss, value, ',')) {
-            row.push_back(std::stod(value));
-        }
-        matrix.push_back(row);
+    KIVI_TRACE_SCOPE("readPhaseMap");
+    if (!isPhaseMapFile(filename)) {
+        return readCsvPhaseMap(filename);
     }
-
-    cv::Mat phaseMap(matrix.size(), matrix[0].size(), CV_64F);
-    for (size_t i = 0; i < matrix.size(); i++) {
-        for (size_t j = 0; j < matrix[i].size(); j++) {
-            phaseMap.at<double>(i, j) = matrix[i][j];
+    auto mapped = std::make_unique<PhaseMapFile>();
+    if (!mapped->open(filename)) {
+        return cv::Mat();
+    }
+    cv::Mat phaseMap = mapped->phase();
+    if (!mapped->mask().empty()) {
+        //the mapping is read only, masked pixels become NaN in a copy and every method then skips them
+        phaseMap = phaseMap.clone();
+        const cv::Mat& mask = mapped->mask();
+        const bool isDouble = phaseMap.type() == CV_64FC1;
+        for (int y = 0; y < phaseMap.rows; ++y) {
+            const uchar* maskRow = mask.ptr<uchar>(y);
+            for (int x = 0; x < phaseMap.cols; ++x) {
+                if (maskRow[x]) continue;
+                if (isDouble) phaseMap.at<double>(y, x) = std::numeric_limits<double>::quiet_NaN();
+                else phaseMap.at<float>(y, x) = std::numeric_limits<float>::quiet_NaN();
+            }
         }
+        return phaseMap;
     }
-
+    mappedPhaseMaps.push_back(std::move(mapped));
     return phaseMap;
 }
-cv::Mat CorrespondenceMatching::calculateDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage) {
-    cv::Mat disparityMap = cv::Mat::zeros(leftImage.rows, leftImage.cols, CV_64F);
+void CorrespondenceMatching::calculateDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage, cv::Mat& disparityMap) {
+    KIVI_TRACE_SCOPE("calculateDisparity");
+    KIVI_TRACE_COUNT("disparity_pixels", static_cast<int64_t>(leftImage.total()));
+    disparityMap.create(leftImage.rows, leftImage.cols, CV_64F);
+    disparityMap.setTo(0.0);
 
     for (int y = 0; y < leftImage.rows; ++y) {
         for (int x = 0; x < leftImage.cols; ++x) {
@@ -38,68 +65,87 @@ cv::Mat CorrespondenceMatching::calculateDisparity(const cv::Mat& leftImage, con
             }
         }
     }
-    return disparityMap;
 }
-//Better approach but in this case every pixel in images have an exact match therefore it seems unnecessary but works well
-/*
-cv::Mat CorrespondenceMatching::calculateDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage, int blockSize, int maxDisparity) {
-    CV_Assert(leftImage.type() == CV_64F && rightImage.type() == CV_64F);
-    CV_Assert(leftImage.rows == rightImage.rows && leftImage.cols == rightImage.cols);
-
-    int width = leftImage.cols;
-    int height = leftImage.rows;
-    cv::Mat disparityMap = cv::Mat::zeros(height, width, CV_64F);
-    int halfBlockSize = blockSize / 2;
-    for (int y = halfBlockSize; y < height - halfBlockSize; ++y) {
-        for (int x = halfBlockSize; x < width - halfBlockSize; ++x) {
-            double minSAD = std::numeric_limits<double>::max();
-            int bestDisparity = 0;
-            // Search for the best match within the disparity range
-            for (int d = 0; d <= maxDisparity; ++d) {
-                if (x - d < halfBlockSize) continue; //bound check
-                double SAD = 0.0;
-                //Sum of Absolute Differences
-                for (int by = -halfBlockSize; by <= halfBlockSize; ++by) {
-                    for (int bx = -halfBlockSize; bx <= halfBlockSize; ++bx) {
-                        double leftPixel = leftImage.at<double>(y + by, x + bx);
-                        double rightPixel = rightImage.at<double>(y + by, x + bx - d);
-                        SAD += std::abs(leftPixel - rightPixel);
-                    }
-                }
-                //update
-                if (SAD < minSAD) {
-                    minSAD = SAD;
-                    bestDisparity = d;
-                }
-            }
-            disparityMap.at<double>(y, x) = static_cast<double>(bestDisparity);
+void CorrespondenceMatching::smoothPhaseMap(const cv::Mat& phaseMap, cv::Mat& quantized, cv::Mat& smoothed) {
+    //converting 8-bit for medianblur
+    phaseMap.convertTo(quantized, CV_8U);
+    //medianBlur for impulse noise and uniform noise
+    medianBlur(quantized, quantized, 5);
+    //for gaussian noise, the filter writes 64 bits itself instead of converting the 8-bit map first
+    if (gaussianKernel.empty()) {
+        gaussianKernel = cv::getGaussianKernel(5, 1.5, CV_64F);
+    }
+    cv::sepFilter2D(quantized, smoothed, CV_64F, gaussianKernel, gaussianKernel);
+    //the 8-bit conversion turned masked pixels into values, they become NaN again so the block matcher skips them
+    const bool isDouble = phaseMap.type() == CV_64FC1;
+    for (int y = 0; y < phaseMap.rows; ++y) {
+        double* smoothedRow = smoothed.ptr<double>(y);
+        for (int x = 0; x < phaseMap.cols; ++x) {
+            const double phase = isDouble ? phaseMap.at<double>(y, x) : phaseMap.at<float>(y, x);
+            if (!std::isfinite(phase)) smoothedRow[x] = std::numeric_limits<double>::quiet_NaN();
         }
     }
-    return disparityMap;
 }
- */
 void CorrespondenceMatching::showDisparityMap(const cv::Mat& disparityMap) {
     cv::Mat displayMap;
-    disparityMap.convertTo(displayMap, CV_8U);
+    if (disparityMap.type() == CV_32F) {
+        //sub-pixel disparities are stretched over 8 bits, pixels without a match stay black
+        float minValue = std::numeric_limits<float>::max(), maxValue = std::numeric_limits<float>::lowest();
+        for (int y = 0; y < disparityMap.rows; ++y) {
+            const float* row = disparityMap.ptr<float>(y);
+            for (int x = 0; x < disparityMap.cols; ++x) {
+                if (std::isnan(row[x])) continue;
+                minValue = std::min(minValue, row[x]);
+                maxValue = std::max(maxValue, row[x]);
+            }
+        }
+        const float scale = maxValue > minValue ? 254.0f / (maxValue - minValue) : 0.0f;
+        displayMap = cv::Mat::zeros(disparityMap.rows, disparityMap.cols, CV_8U);
+        for (int y = 0; y < disparityMap.rows; ++y) {
+            const float* row = disparityMap.ptr<float>(y);
+            uchar* display = displayMap.ptr<uchar>(y);
+            for (int x = 0; x < disparityMap.cols; ++x) {
+                if (!std::isnan(row[x])) display[x] = static_cast<uchar>(1.0f + (row[x] - minValue) * scale);
+            }
+        }
+    }
+    else {
+        disparityMap.convertTo(displayMap, CV_8U);
+    }
     imshow("Disparity Map", displayMap);
     cv::waitKey(0);
 }
-void CorrespondenceMatching::processImages(const std::string& leftFilename, const std::string& rightFilename) {
+cv::Mat CorrespondenceMatching::computeDisparity(const std::string& leftFilename, const std::string& rightFilename) {
+    KIVI_TRACE_SCOPE("computeDisparity");
+    mappedPhaseMaps.clear();
     cv::Mat leftMap = readPhaseMap(leftFilename);
     cv::Mat rightMap = readPhaseMap(rightFilename);
-    //converting 8-bit for medianblur
-    leftMap.convertTo(leftMap, CV_8U);
-    rightMap.convertTo(rightMap, CV_8U);
-    //medianBlur for impulse noise and uniform noise
-    medianBlur(leftMap, leftMap, 5);
-    medianBlur(rightMap, rightMap, 5);
-    //converting 64-bit for gaussianblur
-    leftMap.convertTo(leftMap, CV_64F);
-    rightMap.convertTo(rightMap, CV_64F);
-    //for gaussian noise
-    GaussianBlur(leftMap, leftMap, cv::Size(5, 5), 1.5);
-    GaussianBlur(rightMap, rightMap, cv::Size(5, 5), 1.5);
+    if (leftMap.empty() || rightMap.empty()) {
+        return cv::Mat();
+    }
+    cv::Mat disparityMap;
+    computeDisparity(leftMap, rightMap, disparityMap);
+    return disparityMap;
+}
+void CorrespondenceMatching::computeDisparity(const cv::Mat& leftMap, const cv::Mat& rightMap, cv::Mat& disparity) {
+    if (matchingMethod == MatchingMethod::Phase) {
+        //the search runs on the full precision phase, the 8-bit smoothing below would quantize it away
+        phaseMatcher.match(leftMap, rightMap, disparity, arena);
+        return;
+    }
+    smoothPhaseMap(leftMap, leftQuantized, leftSmoothed);
+    smoothPhaseMap(rightMap, rightQuantized, rightSmoothed);
 
-    cv::Mat disparityMap = calculateDisparity(leftMap, rightMap);
-    showDisparityMap(disparityMap);
+    if (matchingMethod == MatchingMethod::BlockMatching) {
+        blockMatcher.match(leftSmoothed, rightSmoothed, disparity);
+    }
+    else {
+        calculateDisparity(leftSmoothed, rightSmoothed, disparity);
+    }
+}
+void CorrespondenceMatching::processImages(const std::string& leftFilename, const std::string& rightFilename) {
+    cv::Mat disparityMap = computeDisparity(leftFilename, rightFilename);
+    if (!disparityMap.empty() && !headless) {
+        showDisparityMap(disparityMap);
+    }
 }
@@ -5,17 +5,52 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <memory>
 #include <opencv2/opencv.hpp>
+#include "PhaseMapIO.h"
+#include "PhaseMatcher.h"
+#include "BlockMatcher.h"
 
 class CorrespondenceMatching {
 public:
+    //ExactMatch is the original same pixel equality test, Phase searches the rectified row for equal unwrapped phase,
+    //BlockMatching is the SAD block search for scenes where the phase alone is ambiguous
+    enum class MatchingMethod { ExactMatch, Phase, BlockMatching };
     void processImages(const std::string& leftFilename, const std::string& rightFilename);
+    //disparity of the two phase maps without displaying it, empty when a map cannot be read
+    cv::Mat computeDisparity(const std::string& leftFilename, const std::string& rightFilename);
+    //disparity of two phase maps in memory, written into disparity so a caller that keeps it allocates once
+    void computeDisparity(const cv::Mat& leftMap, const cv::Mat& rightMap, cv::Mat& disparity);
+    //scratch of the phase search, nullptr gives every search its own
+    void setArena(FrameArena* arena);
+    void setMatchingMethod(MatchingMethod method);
+    //accepted range of xLeft - xRight for the phase search
+    void setDisparityRange(float minDisparity, float maxDisparity);
+    //block size is rounded up to an odd number
+    void setBlockMatching(int blockSize, int maxDisparity);
+    //true skips the disparity window, for servers without a display
+    void setHeadless(bool enabled);
 
 private:
+    friend class KiviBenchAccess;//kivi_bench times the private stages
+    //.kphm files are mapped and returned without a copy, masked ones are copied with NaN at the masked pixels,
+    //anything else is parsed as CSV
     cv::Mat readPhaseMap(const std::string& filename);
-    cv::Mat calculateDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage);
-    //cv::Mat calculateDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage,int blockSize,int maxDisparity);
+    void calculateDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage, cv::Mat& disparityMap);
+    //8-bit median for impulse noise, then a gaussian for the rest straight into 64 bits
+    void smoothPhaseMap(const cv::Mat& phaseMap, cv::Mat& quantized, cv::Mat& smoothed);
     void showDisparityMap(const cv::Mat& disparityMap);
+    //keeps the mapped phase maps alive while their Mat headers are in use
+    std::vector<std::unique_ptr<PhaseMapFile>> mappedPhaseMaps;
+    MatchingMethod matchingMethod = MatchingMethod::Phase;
+    bool headless = false;
+    PhaseMatcher phaseMatcher;
+    BlockMatcher blockMatcher;
+    FrameArena* arena = nullptr;
+    //buffers of the smoothing, reused by every frame of the same size
+    cv::Mat leftQuantized, rightQuantized;
+    cv::Mat leftSmoothed, rightSmoothed;
+    cv::Mat gaussianKernel;
 };
 
 #endif // CORRESPONDENCEMATCHING_H
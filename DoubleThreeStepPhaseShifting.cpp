@@ -1,45 +1,187 @@
 #include "DoubleThreeStepPhaseShifting.h"
+#include <algorithm>
+#include <limits>
+#include "Trace.h"
+
+namespace {
+    //row buffers of correctOrderRow from the frame arena, reused for every row of a chunk
+    template<typename T>
+    struct OrderCorrectionRow {
+        OrderCorrectionRow(FrameArena& arena, int cols, int radius)
+                : unwrapped(arena.allocate<T>(cols)), window(arena.allocate<T>(2 * radius + 1)),
+                  nearEdge(arena.allocate<unsigned char>(cols)) {}
+        T* unwrapped;
+        T* window;
+        unsigned char* nearEdge;
+    };
+
+    //A Gray-code edge a pixel off the phase wrap puts the pixels in between one period off, which shows as a jump of
+    //more than pi in the unwrapped phase. Only pixels within radius of such a jump are checked, so rows where codes
+    //and wraps agree cost one pass. Each is moved by the whole number of periods that brings its unwrapped phase
+    //closest to the median of its 2 * radius + 1 neighbors. NaN pixels stay out of the medians and keep their order.
+    //Returns the number of changed orders.
+    template<typename T>
+    int correctOrderRow(const T* wrapped, int* orders, int cols, int radius, OrderCorrectionRow<T>& row)
+    {
+        const T period = static_cast<T>(2.0 * CV_PI);
+        std::fill(row.nearEdge, row.nearEdge + cols, 0);
+        for (int x = 0; x < cols; ++x) row.unwrapped[x] = wrapped[x] + period * orders[x];
+        for (int x = 1; x < cols; ++x) {
+            if (!(std::abs(row.unwrapped[x] - row.unwrapped[x - 1]) > static_cast<T>(CV_PI))) continue;//also skips NaN
+            std::fill(row.nearEdge + std::max(0, x - radius), row.nearEdge + std::min(cols, x + radius), 1);
+        }
+        int corrected = 0;
+        for (int x = 0; x < cols; ++x) {
+            if (!row.nearEdge[x] || std::isnan(row.unwrapped[x])) continue;
+            int count = 0;
+            for (int n = std::max(0, x - radius); n <= std::min(cols - 1, x + radius); ++n) {
+                if (!std::isnan(row.unwrapped[n])) row.window[count++] = row.unwrapped[n];
+            }
+            T* middle = row.window + count / 2;
+            std::nth_element(row.window, middle, row.window + count);
+            const int shift = static_cast<int>(std::lround((*middle - row.unwrapped[x]) / period));
+            if (shift == 0) continue;
+            //the window reads unwrapped, which keeps the decoded orders, so the order of the pixels does not matter
+            orders[x] += shift;
+            ++corrected;
+        }
+        return corrected;
+    }
+}
 
 DoubleThreeStepPhaseShifting::DoubleThreeStepPhaseShifting()
 {
 
 }
 
-void DoubleThreeStepPhaseShifting::generatePatterns()
+DoubleThreeStepPhaseShifting::DoubleThreeStepPhaseShifting(int width, int height)
+        : width(width), height(height)
 {
-    patterns.resize(6);
-    for (int k = 0; k < 6; ++k) {
-        patterns[k] = Mat(height, width, CV_8UC1);
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                //convert [-1,1] to [0,1] for proper image
-                double value = 0.5*(1 + cos(2 * CV_PI * x / wavelength +k * CV_PI * phase_shift/180.0));
-                patterns[k].at<uchar>(y, x) = static_cast<uchar>(value *255);
-            }
-        }
+
+}
+
+DoubleThreeStepPhaseShifting::DoubleThreeStepPhaseShifting(const PhaseShiftingConfig& config)
+        : width(config.width), height(config.height), fringes(config.fringes), phase_shift(config.phaseShiftDegrees),
+          numGrayImages(config.numGrayImages > 0 ? config.numGrayImages : PatternGenerator::grayCodeBits(config.fringes)),
+          formula(config.formula), doublePrecision(config.doublePrecision),
+          minModulation(config.minModulation), orderCorrectionRadius(std::max(0, config.orderCorrectionRadius)),
+          grayCodePrefix(config.grayCodePrefix), patternCacheDirectory(config.patternCacheDirectory)
+{
+
+}
+
+bool DoubleThreeStepPhaseShifting::resolvePatternSize()
+{
+    if (width > 0 && height > 0) return true;
+    if (grayCodePrefix.empty()) {
+        std::cerr << "Generated Gray codes need a pattern size" << std::endl;
+        return false;
+    }
+    //the patterns take the size of the captured Gray-code images
+    const std::string filePath = grayCodePrefix + "0.png";
+    Mat first = imread(filePath, IMREAD_GRAYSCALE | IMREAD_ANYDEPTH);
+    if (first.empty()) {
+        std::cerr << "Cannot size the patterns, error reading file: " << filePath << std::endl;
+        return false;
     }
+    width = first.cols;
+    height = first.rows;
+    return true;
+}
+
+double DoubleThreeStepPhaseShifting::stepFactor() const
+{
+    if (formula == PhaseFormula::Equation7) return std::sqrt(3.0);
+    //(1 - cos d) / sin d turns atan2(i1 - i3, 2 * i2 - i1 - i3) into the phase of the middle image for a step d
+    const double step = phase_shift * CV_PI / 180.0;
+    return (1.0 - std::cos(step)) / std::sin(step);
+}
+
+StepKernel DoubleThreeStepPhaseShifting::stepKernel() const
+{
+    if (formula == PhaseFormula::Equation7) return StepKernel::Sqrt3;
+    return phase_shift == 60.0 ? StepKernel::InverseSqrt3 : StepKernel::Runtime;
 }
 
-Mat DoubleThreeStepPhaseShifting::computePhaseMap(const Mat& I1, const Mat& I2, const Mat& I3)
+void DoubleThreeStepPhaseShifting::modulationScales(double& numeratorScale, double& denominatorScale) const
 {
-    Mat phaseMap(height, width, CV_32FC1);
+    //the images follow the projected step even when Equation 7 assumes 120 degrees:
+    //i1 - i3 = 2 B sin d sin(phase) and 2 i2 - i1 - i3 = 2 B (1 - cos d) cos(phase)
+    const double step = phase_shift * CV_PI / 180.0;
+    numeratorScale = 1.0 / (2.0 * std::sin(step) * stepFactor());
+    denominatorScale = 1.0 / (2.0 * (1.0 - std::cos(step)));
+}
+
+void DoubleThreeStepPhaseShifting::setPhaseMode(PhaseMode mode)
+{
+    phaseMode = mode;
+}
+
+void DoubleThreeStepPhaseShifting::setVectorized(bool enabled)
+{
+    phaseKernels = PhaseKernels(enabled);
+}
+
+void DoubleThreeStepPhaseShifting::setArena(FrameArena* arena)
+{
+    externalArena = arena;
+}
+
+FrameArena& DoubleThreeStepPhaseShifting::stageArena()
+{
+    if (externalArena) return *externalArena;
+    ownArena.reset();
+    return ownArena;
+}
+
+PatternGenerator DoubleThreeStepPhaseShifting::patternGenerator() const
+{
+    PatternGenerator generator(width, height, fringes, phase_shift);
+    generator.setCacheDirectory(patternCacheDirectory);
+    return generator;
+}
+
+void DoubleThreeStepPhaseShifting::generatePatterns()
+{
+    //the patterns only vary along x, one row per pattern is computed and copied down
+    patternGenerator().fringePatterns(patterns);
+}
+
+void DoubleThreeStepPhaseShifting::computePhaseMap(const Mat& I1, const Mat& I2, const Mat& I3, Mat& phaseMap, Mat* modulation)
+{
+    KIVI_TRACE_SCOPE("computePhaseMap");
+    KIVI_TRACE_COUNT("phase_pixels", static_cast<int64_t>(width) * height);
+    phaseMap.create(height, width, CV_32FC1);
+    if (modulation) modulation->create(height, width, CV_32FC1);
+    const float factor = static_cast<float>(stepFactor());
+    double numeratorScale, denominatorScale;
+    modulationScales(numeratorScale, denominatorScale);
+    const float sineScale = static_cast<float>(numeratorScale), cosineScale = static_cast<float>(denominatorScale);
+    const StepKernel kernel = stepKernel();
     for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            float i1 = I1.at<uchar>(y, x);
-            float i2 = I2.at<uchar>(y, x);
-            float i3 = I3.at<uchar>(y, x);
-            phaseMap.at<float>(y, x) = atan2(sqrt(3) * (i1 - i3), 2 * i2 - i1 - i3);//Equation 7
+        float* modulationRow = modulation ? modulation->ptr<float>(y) : nullptr;
+        if (kernel == StepKernel::Sqrt3) {
+            phaseKernels.wrappedPhase<StepKernel::Sqrt3>(I1.ptr<uchar>(y), I2.ptr<uchar>(y), I3.ptr<uchar>(y), phaseMap.ptr<float>(y), width,
+                                                         modulationRow, sineScale, cosineScale);//Equation 7
+        }
+        else if (kernel == StepKernel::InverseSqrt3) {
+            phaseKernels.wrappedPhase<StepKernel::InverseSqrt3>(I1.ptr<uchar>(y), I2.ptr<uchar>(y), I3.ptr<uchar>(y), phaseMap.ptr<float>(y), width,
+                                                                modulationRow, sineScale, cosineScale);
+        }
+        else {
+            phaseKernels.wrappedPhaseRow<StepKernel::Runtime>(I1.ptr<uchar>(y), I2.ptr<uchar>(y), I3.ptr<uchar>(y), phaseMap.ptr<float>(y), width,
+                                                              factor, modulationRow, sineScale, cosineScale);
         }
     }
-    return phaseMap;
 }
 
 void DoubleThreeStepPhaseShifting::averagePhaseMaps()
 {
+    KIVI_TRACE_SCOPE("averagePhaseMaps");
     //check but can be removed
     assert(phaseMap1.size()==phaseMap2.size() && phaseMap1.type() == CV_32FC1 && phaseMap2.type() == CV_32FC1);
 
-    averagePhaseMap = Mat(phaseMap1.size(), CV_32FC1);
+    averagePhaseMap.create(phaseMap1.size(), CV_32FC1);
 
     for (int y = 0; y < phaseMap1.rows; ++y) {
         for (int x = 0; x < phaseMap1.cols; ++x) {
@@ -56,49 +198,102 @@ void DoubleThreeStepPhaseShifting::averagePhaseMaps()
         }
     }
 }
-void DoubleThreeStepPhaseShifting::loadGrayImages(std::vector<cv::Mat>& grayImages, int numGrayImages, const std::string& basePath)
+bool DoubleThreeStepPhaseShifting::loadGrayImages(std::vector<cv::Mat>& grayImages, int numGrayImages, const std::string& basePath)
 {
+    KIVI_TRACE_SCOPE("loadGrayImages");
     grayImages.resize(numGrayImages);  //vector for grayImages
 
     for (int i = 0; i < numGrayImages; ++i) {
         std::string filePath = basePath + std::to_string(i) + ".png";//filepath
         // Load the image in grayscale
-        grayImages[i] = cv::imread(filePath, cv::IMREAD_GRAYSCALE);
+        grayImages[i] = cv::imread(filePath, cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);//16-bit captures stay 16-bit
         if (grayImages[i].empty()) {
             std::cerr << "Error reading file: " << filePath << std::endl;
+            return false;
+        }
+        if (grayImages[i].cols != width || grayImages[i].rows != height) {
+            std::cerr << "Gray-code image " << filePath << " is not " << width << "x" << height << std::endl;
+            return false;
         }
     }
+    return true;
 }
-int DoubleThreeStepPhaseShifting::grayToBinary(int gray)
+bool DoubleThreeStepPhaseShifting::acquireGrayImages()
 {
-    int binary = 0;
-    for (; gray; gray >>= 1) {
-        binary ^= gray;
+    if (!grayCodePrefix.empty()) {
+        return loadGrayImages(grayImages,numGrayImages,grayCodePrefix);
     }
-    return binary;
+    PatternGenerator generator = patternGenerator();
+    generator.grayCodePatterns(grayImages);
+    numGrayImages = generator.grayCodeCount();
+    return true;
 }
+
 void DoubleThreeStepPhaseShifting::decodeGrayImages()
 {
-    fringeOrders = Mat(height, width, CV_32SC1, Scalar(0));
+    KIVI_TRACE_SCOPE("decodeGrayImages");
+    KIVI_TRACE_COUNT("gray_code_pixels", static_cast<int64_t>(width) * height * numGrayImages);
+    //the kernels write every order, the buffer of the last frame is reused
+    fringeOrders.create(height, width, CV_32SC1);
+    FrameArena& scratch = stageArena();
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0;x < width; ++x) {
-            int decimalValue = 0;
+    if (!grayImages.empty() && grayImages[0].depth() == CV_16U) {
+        const ushort** codeRows = scratch.allocate<const ushort*>(numGrayImages);
+        for (int y = 0; y < height; ++y) {
             for (int k = 0; k<numGrayImages; ++k) {
-                // In gray
-                bool bit = grayImages[k].at<uchar>(y, x) > 0;
-                decimalValue |= (bit << (numGrayImages - 1 - k));
+                codeRows[k] = grayImages[k].ptr<ushort>(y);
+            }
+            phaseKernels.decodeGrayRow(codeRows, numGrayImages, fringeOrders.ptr<int>(y), width);
+        }
+        return;
+    }
+    const uchar** codeRows = scratch.allocate<const uchar*>(numGrayImages);
+    for (int y = 0; y < height; ++y) {
+        for (int k = 0; k<numGrayImages; ++k) {
+            codeRows[k] = grayImages[k].ptr<uchar>(y);
+        }
+        //thresholding and Gray to binary conversion of the whole row
+        phaseKernels.decodeGray(codeRows, numGrayImages, fringeOrders.ptr<int>(y), width);
+    }
+}
+
+void DoubleThreeStepPhaseShifting::applyQuality()
+{
+    KIVI_TRACE_SCOPE("applyQuality");
+    int64_t masked = 0, corrected = 0;
+    if (minModulation > 0.0f) {
+        quality.create(height, width, CV_32FC1);
+        for (int y = 0; y < height; ++y) {
+            const float* modulation1 = modulationMap1.ptr<float>(y);
+            const float* modulation2 = modulationMap2.ptr<float>(y);
+            float* qualityRow = quality.ptr<float>(y);
+            float* phase = averagePhaseMap.ptr<float>(y);
+            for (int x = 0; x < width; ++x) {
+                qualityRow[x] = std::min(modulation1[x], modulation2[x]);
+                if (qualityRow[x] >= minModulation) continue;
+                //NaN carries the mask through unwrapping, correspondence and triangulation
+                phase[x] = std::numeric_limits<float>::quiet_NaN();
+                ++masked;
             }
-            //Conversion to binary
-            decimalValue = grayToBinary(decimalValue);
-            fringeOrders.at<int>(y, x) = decimalValue;
         }
     }
+    else {
+        quality.release();
+    }
+    if (orderCorrectionRadius > 0) {
+        OrderCorrectionRow<float> row(stageArena(), width, orderCorrectionRadius);
+        for (int y = 0; y < height; ++y) {
+            corrected += correctOrderRow(averagePhaseMap.ptr<float>(y), fringeOrders.ptr<int>(y), width, orderCorrectionRadius, row);
+        }
+    }
+    KIVI_TRACE_COUNT("masked_pixels", masked);
+    KIVI_TRACE_COUNT("corrected_orders", corrected);
 }
 
 void DoubleThreeStepPhaseShifting::unwrapPhaseMap()
 {
-    unwrappedPhaseMap = Mat(height, width, CV_32FC1, Scalar(0));
+    KIVI_TRACE_SCOPE("unwrapPhaseMap");
+    unwrappedPhaseMap.create(height, width, CV_32FC1);
 
     for (int y = 0;y < height; ++y) {
         for (int x = 0; x<width; ++x) {
@@ -109,6 +304,118 @@ void DoubleThreeStepPhaseShifting::unwrapPhaseMap()
     }
 }
 
+template<StepKernel Kernel, typename FringePixel, typename CodePixel, typename Accumulator>
+void DoubleThreeStepPhaseShifting::unwrapRows(const vector<Mat>& fringeImages, const vector<Mat>& grayCodeImages, Mat& unwrapped, Mat& qualityOut,
+                                              Accumulator stepFactor, FrameArena& scratch) const
+{
+    const int rows = fringeImages[0].rows, cols = fringeImages[0].cols;
+    const int codeBits = static_cast<int>(grayCodeImages.size());
+    unwrapped.create(rows, cols, std::is_same<Accumulator, double>::value ? CV_64FC1 : CV_32FC1);
+    const bool masking = minModulation > 0.0f;
+    const bool guided = masking || orderCorrectionRadius > 0;
+    double numeratorScale, denominatorScale;
+    modulationScales(numeratorScale, denominatorScale);
+    const Accumulator sineScale = static_cast<Accumulator>(numeratorScale), cosineScale = static_cast<Accumulator>(denominatorScale);
+    if (masking) qualityOut.create(rows, cols, CV_32FC1);
+    else qualityOut.release();
+
+    //rows are independent, each one streams its input rows once and writes its output row once
+    parallelRows(Range(0, rows), [&](const Range& range) {
+        //row buffers of the chunk come from the arena, the modulation and wrapped rows only with masking or order correction
+        const CodePixel** codeRows = scratch.allocate<const CodePixel*>(codeBits);
+        Accumulator* phase1 = scratch.allocate<Accumulator>(cols);
+        Accumulator* phase2 = scratch.allocate<Accumulator>(cols);
+        int* orders = scratch.allocate<int>(cols);
+        Accumulator* modulation1 = masking ? scratch.allocate<Accumulator>(cols) : nullptr;
+        Accumulator* modulation2 = masking ? scratch.allocate<Accumulator>(cols) : nullptr;
+        Accumulator* wrapped = guided ? scratch.allocate<Accumulator>(cols) : nullptr;
+        OrderCorrectionRow<Accumulator> correctionRow(scratch, orderCorrectionRadius > 0 ? cols : 0, orderCorrectionRadius);
+        int64_t masked = 0, corrected = 0;
+        for (int y = range.start; y < range.end; ++y) {
+            const FringePixel* f[6];
+            for (int k = 0; k < 6; ++k) f[k] = fringeImages[k].ptr<FringePixel>(y);
+            for (int k = 0; k < codeBits; ++k) codeRows[k] = grayCodeImages[k].ptr<CodePixel>(y);
+            Accumulator* out = unwrapped.ptr<Accumulator>(y);
+
+            //both sets and the fringe orders, all from the same kernels as the step-by-step path
+            phaseKernels.wrappedPhaseRow<Kernel>(f[0], f[1], f[2], phase1, cols, stepFactor, modulation1, sineScale, cosineScale);
+            phaseKernels.wrappedPhaseRow<Kernel>(f[3], f[4], f[5], phase2, cols, stepFactor, modulation2, sineScale, cosineScale);
+            phaseKernels.decodeGrayRow(codeRows, codeBits, orders, cols);
+            if (!guided) {
+                for (int x = 0; x < cols; ++x) {
+                    //complex average of averagePhaseMaps
+                    complex<Accumulator> averagedComplex = Accumulator(0.5) * (complex<Accumulator>(cos(phase1[x]), sin(phase1[x])) + complex<Accumulator>(cos(phase2[x]), sin(phase2[x])));
+                    Accumulator wrappedPhase = atan2(averagedComplex.imag(), averagedComplex.real());
+                    out[x] = wrappedPhase + 2.0 * CV_PI * orders[x];//2piK
+                }
+                continue;
+            }
+            //same arithmetic as above, with the wrapped row kept for the mask and the order correction
+            for (int x = 0; x < cols; ++x) {
+                complex<Accumulator> averagedComplex = Accumulator(0.5) * (complex<Accumulator>(cos(phase1[x]), sin(phase1[x])) + complex<Accumulator>(cos(phase2[x]), sin(phase2[x])));
+                wrapped[x] = atan2(averagedComplex.imag(), averagedComplex.real());
+            }
+            if (masking) {
+                float* qualityRow = qualityOut.ptr<float>(y);
+                for (int x = 0; x < cols; ++x) {
+                    qualityRow[x] = static_cast<float>(std::min(modulation1[x], modulation2[x]));
+                    if (qualityRow[x] >= minModulation) continue;
+                    wrapped[x] = std::numeric_limits<Accumulator>::quiet_NaN();
+                    ++masked;
+                }
+            }
+            if (orderCorrectionRadius > 0) corrected += correctOrderRow(wrapped, orders, cols, orderCorrectionRadius, correctionRow);
+            for (int x = 0; x < cols; ++x) {
+                out[x] = wrapped[x] + 2.0 * CV_PI * orders[x];//2piK, NaN stays NaN
+            }
+        }
+        KIVI_TRACE_COUNT("masked_pixels", masked);
+        KIVI_TRACE_COUNT("corrected_orders", corrected);
+    });
+}
+
+void DoubleThreeStepPhaseShifting::computeUnwrappedPhaseFused(const vector<Mat>& fringeImages, const vector<Mat>& grayCodeImages, Mat& unwrapped)
+{
+    KIVI_TRACE_SCOPE("computeUnwrappedPhaseFused");
+    KIVI_TRACE_COUNT("phase_pixels", static_cast<int64_t>(width) * height);
+    CV_Assert(fringeImages.size() == 6);
+    const int fringeDepth = fringeImages[0].depth();
+    const int codeDepth = grayCodeImages.empty() ? CV_8U : grayCodeImages[0].depth();
+    CV_Assert((fringeDepth == CV_8U || fringeDepth == CV_16U) && (codeDepth == CV_8U || codeDepth == CV_16U));
+    for (const auto& image : fringeImages) CV_Assert(image.type() == CV_MAKETYPE(fringeDepth, 1) && image.size() == fringeImages[0].size());
+    for (const auto& image : grayCodeImages) CV_Assert(image.type() == CV_MAKETYPE(codeDepth, 1) && image.size() == fringeImages[0].size());
+
+    //one instantiation per camera depth, accumulator and step kernel, 8-bit float Equation 7 is the original path
+    const double factor = stepFactor();
+    const StepKernel kernel = stepKernel();
+    FrameArena& scratch = stageArena();
+    auto run = [&](auto fringePixel, auto codePixel, auto accumulator) {
+        using FringePixel = decltype(fringePixel);
+        using CodePixel = decltype(codePixel);
+        using Accumulator = decltype(accumulator);
+        const Accumulator stepFactor = static_cast<Accumulator>(factor);
+        if (kernel == StepKernel::Sqrt3) {
+            unwrapRows<StepKernel::Sqrt3, FringePixel, CodePixel>(fringeImages, grayCodeImages, unwrapped, quality, stepFactor, scratch);
+        }
+        else if (kernel == StepKernel::InverseSqrt3) {
+            unwrapRows<StepKernel::InverseSqrt3, FringePixel, CodePixel>(fringeImages, grayCodeImages, unwrapped, quality, stepFactor, scratch);
+        }
+        else {
+            unwrapRows<StepKernel::Runtime, FringePixel, CodePixel>(fringeImages, grayCodeImages, unwrapped, quality, stepFactor, scratch);
+        }
+    };
+    auto withCodes = [&](auto fringePixel, auto accumulator) {
+        if (codeDepth == CV_16U) run(fringePixel, ushort(), accumulator);
+        else run(fringePixel, uchar(), accumulator);
+    };
+    auto withFringes = [&](auto accumulator) {
+        if (fringeDepth == CV_16U) withCodes(ushort(), accumulator);
+        else withCodes(uchar(), accumulator);
+    };
+    if (doublePrecision) withFringes(double());
+    else withFringes(float());
+}
+
 void DoubleThreeStepPhaseShifting::plotRow(int rowIndex, const string& windowName)
 {
     Mat plotImage = Mat::zeros(400, unwrappedPhaseMap.cols, CV_8UC3);
@@ -128,28 +435,74 @@ void DoubleThreeStepPhaseShifting::plotRow(int rowIndex, const string& windowNam
     imshow(windowName, plotImage);
 }
 
-void DoubleThreeStepPhaseShifting::processPhaseShift()
+bool DoubleThreeStepPhaseShifting::writePhaseMap(const string& filename) const
+{
+    KIVI_TRACE_SCOPE("writePhaseMap");
+    if (unwrappedPhaseMap.empty()) {
+        std::cerr << "No unwrapped phase map to write" << std::endl;
+        return false;
+    }
+    if (quality.empty()) return PhaseMapFile::write(filename, unwrappedPhaseMap);
+    //masked pixels are also flagged in the file, so readers that ignore NaN still skip them
+    Mat mask(unwrappedPhaseMap.rows, unwrappedPhaseMap.cols, CV_8UC1);
+    for (int y = 0; y < mask.rows; ++y) {
+        const float* qualityRow = quality.ptr<float>(y);
+        uchar* maskRow = mask.ptr<uchar>(y);
+        for (int x = 0; x < mask.cols; ++x) maskRow[x] = qualityRow[x] >= minModulation ? 255 : 0;
+    }
+    return PhaseMapFile::write(filename, unwrappedPhaseMap, mask);
+}
+
+void DoubleThreeStepPhaseShifting::setHeadless(bool enabled)
 {
+    headless = enabled;
+}
+
+void DoubleThreeStepPhaseShifting::setGrayCodePrefix(const string& prefix)
+{
+    grayCodePrefix = prefix;
+}
+
+bool DoubleThreeStepPhaseShifting::processPhaseShift()
+{
+    if (!resolvePatternSize()) return false;
     //1.Generating patterns
     generatePatterns();
-    //2.Compute phase maps and displaying them
-    phaseMap1 = computePhaseMap(patterns[0], patterns[1], patterns[2]);
-    phaseMap2 = computePhaseMap(patterns[3], patterns[4], patterns[5]);
-    cv::imshow("Phase Map 1", phaseMap1);
-    cv::imshow("Phase Map 2", phaseMap2);
+    if (phaseMode == PhaseMode::Fused) {
+        if (!acquireGrayImages()) return false;
+        computeUnwrappedPhaseFused(patterns, grayImages, unwrappedPhaseMap);
+        if (!headless) {
+            plotRow(height / 2, "Unwrapped Phase Plot Row");
+            cv::waitKey(0);
+        }
+        return true;
+    }
+    //2.Compute phase maps and displaying them, with the fringe modulation when pixels are masked
+    const bool masking = minModulation > 0.0f;
+    computePhaseMap(patterns[0], patterns[1], patterns[2], phaseMap1, masking ? &modulationMap1 : nullptr);
+    computePhaseMap(patterns[3], patterns[4], patterns[5], phaseMap2, masking ? &modulationMap2 : nullptr);
+    if (!headless) {
+        cv::imshow("Phase Map 1", phaseMap1);
+        cv::imshow("Phase Map 2", phaseMap2);
+    }
     //3.Averaging phase maps
     averagePhaseMaps();
-    cv::imshow("Average Phase Map", averagePhaseMap);
+    if (!headless) {
+        cv::imshow("Average Phase Map", averagePhaseMap);
+    }
     //4.Loading Gray-coded images
-    std::string filePath = "double-three-step/gray_pattern_";
-    loadGrayImages(grayImages,7,filePath);
+    if (!acquireGrayImages()) return false;
     //5.Decimal Matrix
     decodeGrayImages();
+    //Masking and order correction
+    if (masking || orderCorrectionRadius > 0) applyQuality();
+    else quality.release();
     //Unwrapping
     unwrapPhaseMap();
     //Plot
-    plotRow(height / 2, "Unwrapped Phase Plot Row");
-    cv::waitKey(0);
+    if (!headless) {
+        plotRow(height / 2, "Unwrapped Phase Plot Row");
+        cv::waitKey(0);
+    }
+    return true;
 }
-
-
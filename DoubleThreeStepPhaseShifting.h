@@ -1,29 +1,125 @@
+#ifndef DOUBLETHREESTEPPHASESHIFTING_H
+#define DOUBLETHREESTEPPHASESHIFTING_H
+
 #include <opencv2/opencv.hpp>
 #include <iostream>
 #include <cmath>
 #include <vector>
 #include <complex>
+#include "FrameArena.h"
+#include "PatternGenerator.h"
+#include "PhaseKernels.h"
+#include "PhaseMapIO.h"
 
 using namespace cv;
 using namespace std;
 
+//Equation7 is the decoder's sqrt(3) form, GeneralStep uses the factor (1 - cos d) / sin d of the configured step d
+enum class PhaseFormula { Equation7, GeneralStep };
+
+//Pattern and decoding parameters, the defaults are the 1280x720 setup the project started with.
+struct PhaseShiftingConfig {
+    //0 takes the size of the first Gray-code image
+    int width = 1280, height = 720;
+    //fringes across the width, the wavelength in pixels is width / fringes
+    double fringes = 128.0;
+    double phaseShiftDegrees = 60.0;
+    //0 uses the ceil(log2(fringes)) images that number every fringe
+    int numGrayImages = 0;
+    //empty decodes the generated Gray-code patterns instead of captures
+    string grayCodePrefix = "double-three-step/gray_pattern_";
+    //directory of the pattern row cache, empty computes the rows on every run
+    string patternCacheDirectory;
+    PhaseFormula formula = PhaseFormula::Equation7;
+    //accumulates in double and gives a CV_64F unwrapped map in Fused mode, float gives CV_32F
+    bool doublePrecision = false;
+    //pixels whose fringe modulation, the lower one of the two sets, is below this many gray levels become NaN,
+    //0 keeps every pixel and skips the modulation
+    float minModulation = 0.0f;
+    //orders within this many pixels of a Gray-code edge that misses the phase wrap, seen as a 2 pi jump of the
+    //unwrapped phase, are corrected against the median of the 2 * radius + 1 pixels around them, 0 keeps the decoded orders
+    int orderCorrectionRadius = 0;
+};
+
 class DoubleThreeStepPhaseShifting {
 public:
+    enum class PhaseMode { StepByStep, Fused };
     DoubleThreeStepPhaseShifting();
-    void processPhaseShift();
+    //pattern and decoding size, the wavelength keeps 128 fringes across the width
+    DoubleThreeStepPhaseShifting(int width, int height);
+    explicit DoubleThreeStepPhaseShifting(const PhaseShiftingConfig& config);
+    //false when the pattern size or the Gray-code images cannot be read
+    bool processPhaseShift();
+    void setPhaseMode(PhaseMode mode);
+    //false keeps the scalar atan2, the AVX2 atan2 is within 2.4e-7 rad of it
+    void setVectorized(bool enabled);
+    //Decodes the six fringe images and the Gray-code images into unwrapped phase in a single sweep.
+    //Uses the same arithmetic as the step-by-step path, so both give identical maps.
+    //Fringe and Gray-code images may be CV_8U or CV_16U, the output is CV_32F or CV_64F with doublePrecision.
+    //unwrapped keeps its buffer when the size and type stay, the row scratch comes from the arena.
+    void computeUnwrappedPhaseFused(const vector<Mat>& fringeImages, const vector<Mat>& grayCodeImages, Mat& unwrapped);
+    //writes the last unwrapped phase map as a binary .kphm file for CorrespondenceMatching
+    bool writePhaseMap(const string& filename) const;
+    const Mat& unwrappedPhase() const { return unwrappedPhaseMap; }
+    //CV_32F lower modulation of the two fringe sets, empty unless minModulation is set
+    const Mat& qualityMap() const { return quality; }
+    //true skips every window, for servers without a display
+    void setHeadless(bool enabled);
+    //Gray-code images are read from <prefix>0.png ... <prefix>N-1.png, an empty prefix uses the generated ones
+    void setGrayCodePrefix(const string& prefix);
+    //generator of the projected patterns for the current size, fringes and phase step
+    PatternGenerator patternGenerator() const;
+    //scratch of the decoding stages comes from arena, which the caller resets between frames.
+    //Null uses an arena of the decoder that every stage resets before it takes its scratch.
+    void setArena(FrameArena* arena);
 private:
+    friend class KiviBenchAccess;//kivi_bench times the private stages
+    //fills in a width or height of 0 from the first Gray-code image
+    bool resolvePatternSize();
+    //factor in front of (i1 - i3) for the configured formula and step
+    double stepFactor() const;
+    //kernel with that factor compiled in, Runtime for general steps other than 60 degrees
+    StepKernel stepKernel() const;
+    //scales of the atan2 numerator and denominator that give the fringe modulation of the configured step,
+    //whichever formula computes the phase
+    void modulationScales(double& numeratorScale, double& denominatorScale) const;
+    template<StepKernel Kernel, typename FringePixel, typename CodePixel, typename Accumulator>
+    void unwrapRows(const vector<Mat>& fringeImages, const vector<Mat>& grayCodeImages, Mat& unwrapped, Mat& qualityOut,
+                    Accumulator stepFactor, FrameArena& scratch) const;
+    //arena for the scratch of one stage. The own arena is reset first, no stage keeps scratch in it past its end.
+    FrameArena& stageArena();
     void generatePatterns();
-    Mat computePhaseMap(const Mat& I1, const Mat& I2, const Mat& I3);
+    //writes into phaseMap, modulation is filled in the same pass when given
+    void computePhaseMap(const Mat& I1, const Mat& I2, const Mat& I3, Mat& phaseMap, Mat* modulation = nullptr);
     void averagePhaseMaps();
-    void loadGrayImages(std::vector<cv::Mat>& grayImages, int numGrayImages, const std::string& basePath);
-    int grayToBinary(int gray);
+    //false when an image is missing or does not have the pattern size
+    bool loadGrayImages(std::vector<cv::Mat>& grayImages, int numGrayImages, const std::string& basePath);
+    //captured Gray-code images, or the generated patterns without a prefix
+    bool acquireGrayImages();
     void decodeGrayImages();
+    //masks low-modulation pixels of the average phase and corrects the fringe orders near code edges
+    void applyQuality();
     void unwrapPhaseMap();
     void plotRow(int rowIndex, const string& windowName);
     int width = 1280, height = 720;
-    double phase_shift = 60, wavelength = width/128.0;
+    double fringes = 128.0;
+    double phase_shift = 60;
     int numGrayImages=7;
+    PhaseFormula formula = PhaseFormula::Equation7;
+    bool doublePrecision = false;
+    float minModulation = 0.0f;
+    int orderCorrectionRadius = 0;
     vector<Mat> patterns;
     vector<Mat> grayImages;
     Mat phaseMap1, phaseMap2, averagePhaseMap, fringeOrders, unwrappedPhaseMap;
-};
\ No newline at end of file
+    Mat modulationMap1, modulationMap2, quality;
+    PhaseMode phaseMode = PhaseMode::StepByStep;
+    bool headless = false;
+    string grayCodePrefix = "double-three-step/gray_pattern_";
+    string patternCacheDirectory;
+    PhaseKernels phaseKernels;
+    FrameArena ownArena;
+    FrameArena* externalArena = nullptr;
+};
+
+#endif // DOUBLETHREESTEPPHASESHIFTING_H
@@ -0,0 +1,68 @@
+#include "FrameArena.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace {
+    const size_t arenaAlignment = 64;
+
+    size_t alignUp(size_t value)
+    {
+        return (value + arenaAlignment - 1) & ~(arenaAlignment - 1);
+    }
+}
+
+void FrameArena::FreeDeleter::operator()(unsigned char* memory) const
+{
+    std::free(memory);
+}
+
+FrameArena::Block FrameArena::allocateBlock(size_t bytes)
+{
+    void* memory = std::aligned_alloc(arenaAlignment, alignUp(std::max<size_t>(bytes, 1)));
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return Block(static_cast<unsigned char*>(memory));
+}
+
+FrameArena::FrameArena(size_t initialBytes)
+{
+    if (initialBytes == 0) return;
+    blockBytes = alignUp(initialBytes);
+    block = allocateBlock(blockBytes);
+}
+
+void* FrameArena::allocate(size_t bytes)
+{
+    const size_t size = alignUp(std::max<size_t>(bytes, 1));
+    //the offset keeps counting past the block, so it also measures what a frame needs
+    const size_t offset = used.fetch_add(size, std::memory_order_relaxed);
+    if (offset + size <= blockBytes) return block.get() + offset;
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    overflow.push_back(allocateBlock(size));
+    return overflow.back().get();
+}
+
+cv::Mat FrameArena::mat(int rows, int cols, int type)
+{
+    const size_t bytes = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+    return cv::Mat(rows, cols, type, allocate(bytes));
+}
+
+void FrameArena::reset()
+{
+    peak = std::max(peak, used.load(std::memory_order_relaxed));
+    used.store(0, std::memory_order_relaxed);
+    if (overflow.empty()) return;
+    //one block of the high-water size replaces the block and the overflow of the growing frames
+    overflow.clear();
+    block.reset();
+    blockBytes = alignUp(peak);
+    block = allocateBlock(blockBytes);
+}
+
+size_t FrameArena::highWater() const
+{
+    return std::max(peak, used.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,65 @@
+#ifndef FRAMEARENA_H
+#define FRAMEARENA_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//Scratch memory of one pipeline, shared by all of its stages.
+//Stages take their temporary rows and maps from the arena instead of the heap, and the owner calls reset()
+//once their results are written, typically after every stage of a frame. allocate() is a lock-free bump of
+//one offset and may be called from the worker threads of a stage. What does not fit into the block goes to
+//an overflow list on the heap. reset() then replaces the block by one of the high-water size, so after the
+//first frame of a given size a frame allocates nothing.
+class FrameArena {
+public:
+    explicit FrameArena(size_t initialBytes = 0);
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    //64-byte aligned and uninitialized, valid until the next reset()
+    void* allocate(size_t bytes);
+    template<typename T>
+    T* allocate(size_t count) { return static_cast<T*>(allocate(count * sizeof(T))); }
+    //rows x cols header over arena memory, the Mat does not own it and must not outlive the next reset()
+    cv::Mat mat(int rows, int cols, int type);
+    //takes back everything allocated since the last reset, call when no stage is using the arena
+    void reset();
+
+    size_t capacity() const { return blockBytes; }
+    //largest amount requested between two resets so far
+    size_t highWater() const;
+
+private:
+    struct FreeDeleter {
+        void operator()(unsigned char* memory) const;
+    };
+    using Block = std::unique_ptr<unsigned char, FreeDeleter>;
+    static Block allocateBlock(size_t bytes);
+
+    Block block;
+    size_t blockBytes = 0;
+    std::atomic<size_t> used{0};
+    size_t peak = 0;
+    //requests that did not fit, only taken while the arena grows
+    std::mutex overflowMutex;
+    std::vector<Block> overflow;
+};
+
+//cv::parallel_for_ over a lambda without the std::function it would otherwise be wrapped in, which allocates
+//as soon as the lambda captures more than two references
+template<typename Body>
+void parallelRows(const cv::Range& range, const Body& body)
+{
+    struct LoopBody : cv::ParallelLoopBody {
+        explicit LoopBody(const Body& body) : body(body) {}
+        void operator()(const cv::Range& part) const override { body(part); }
+        const Body& body;
+    };
+    cv::parallel_for_(range, LoopBody(body));
+}
+
+#endif // FRAMEARENA_H
@@ -0,0 +1,193 @@
+#include "IncrementalBilateralFilter.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+namespace {
+    //x rows and y columns of a tile, the columns are a multiple of the vector block alignment
+    constexpr int tileRows = 64;
+    constexpr int tileCols = 128;
+    //widest vector kernel, windows start on multiples of it
+    constexpr int blockAlignment = 16;
+
+    bool pointChanged(const float* const* a, const uint8_t* aValid, const float* const* b, const uint8_t* bValid, size_t p, float tolerance)
+    {
+        if ((aValid[p] != 0) != (bValid[p] != 0)) return true;
+        if (!aValid[p]) return false;
+        for (int k = 0; k < OrganizedPointCloud::ChannelCount; ++k) {
+            if (!(std::fabs(a[k][p] - b[k][p]) <= tolerance)) return true;
+        }
+        return false;
+    }
+
+    //copies the points [y0, y0 + count) of rows [x0, x0 + rows) of source to row firstRow and column column of target
+    void copyBlock(const OrganizedPointCloud& source, int x0, int y0, int rows, int count, OrganizedPointCloud& target, int firstRow, int column)
+    {
+        for (int i = 0; i < rows; ++i) {
+            const size_t from = source.index(x0 + i, y0);
+            const size_t to = target.index(firstRow + i, column);
+            for (int k = 0; k < OrganizedPointCloud::ChannelCount; ++k) {
+                std::memcpy(target.channel(k) + to, source.channel(k) + from, count * sizeof(float));
+            }
+            std::memcpy(target.validMask() + to, source.validMask() + from, count);
+        }
+    }
+}
+
+IncrementalBilateralFilter::IncrementalBilateralFilter(const BilateralFilterConfig& config, float tolerance)
+        : config(config), tolerance(tolerance),
+          halo(std::max(0, config.iterations) * std::max(1, config.radius)),
+          threadPool(config.threads)
+{
+    //a window point is filtered by the same kernel as in the full pass when the window starts on a block
+    //boundary and the tile ends at least one block plus the kernel reach before the window does
+    const int reach = std::max(halo, std::max(1, config.radius) + blockAlignment);
+    windowHaloY = (reach + blockAlignment - 1) / blockAlignment * blockAlignment;
+
+    BilateralFilterConfig tileConfig = config;
+    tileConfig.threads = 1;
+    tileConfig.streamingBandRows = 0;
+    workers.resize(threadPool.size());
+    for (auto& worker : workers) {
+        worker.filter = std::make_unique<BilateralFilter>("", "", tileConfig);
+    }
+}
+
+IncrementalBilateralFilter::~IncrementalBilateralFilter() = default;
+
+void IncrementalBilateralFilter::reset()
+{
+    hasReference = false;
+}
+
+void IncrementalBilateralFilter::setReference(const OrganizedPointCloud& raw, const OrganizedPointCloud& filteredCloud)
+{
+    reference.copyFrom(raw);
+    filtered.copyFrom(filteredCloud);
+    hasReference = raw.width() == filteredCloud.width() && raw.height() == filteredCloud.height();
+}
+
+const OrganizedPointCloud& IncrementalBilateralFilter::filter(const OrganizedPointCloud& raw)
+{
+    if (!hasReference || raw.width() != reference.width() || raw.height() != reference.height()) {
+        reference.copyFrom(raw);
+        filtered.copyFrom(raw);
+        BilateralFilter full("", "", config);
+        full.filterPointCloud(filtered);
+        hasReference = true;
+        lastChanged = raw.size();
+        lastRefiltered = raw.size();
+        return filtered;
+    }
+    findChanges(raw);
+    refilterTiles();
+    return filtered;
+}
+
+void IncrementalBilateralFilter::findChanges(const OrganizedPointCloud& raw)
+{
+    tilesX = (raw.width() + tileRows - 1) / tileRows;
+    tilesY = (raw.height() + tileCols - 1) / tileCols;
+    tiles.assign(static_cast<size_t>(tilesX) * tilesY, Tile{1, 0, 1, 0, false});
+
+    const float* in[OrganizedPointCloud::ChannelCount];
+    float* previous[OrganizedPointCloud::ChannelCount];
+    for (int k = 0; k < OrganizedPointCloud::ChannelCount; ++k) {
+        in[k] = raw.channel(k);
+        previous[k] = reference.channel(k);
+    }
+    const uint8_t* inValid = raw.validMask();
+    uint8_t* previousValid = reference.validMask();
+    std::atomic<size_t> changed{0};
+
+    //a tile row of tiles belongs to one chunk, so the bounding boxes are written without locks
+    threadPool.parallelFor(tilesX, 1, [&](int firstTile, int lastTile) {
+        size_t count = 0;
+        for (int tx = firstTile; tx < lastTile; ++tx) {
+            const int xEnd = std::min(raw.width(), (tx + 1) * tileRows);
+            for (int x = tx * tileRows; x < xEnd; ++x) {
+                for (int y = 0; y < raw.height(); ++y) {
+                    const size_t p = raw.index(x, y);
+                    if (!pointChanged(in, inValid, previous, previousValid, p, tolerance)) continue;
+                    //the reference follows the points that were taken over
+                    for (int k = 0; k < OrganizedPointCloud::ChannelCount; ++k) previous[k][p] = in[k][p];
+                    previousValid[p] = inValid[p];
+                    Tile& tile = tiles[static_cast<size_t>(tx) * tilesY + y / tileCols];
+                    if (tile.minX > tile.maxX) {
+                        tile.minX = tile.maxX = x;
+                        tile.minY = tile.maxY = y;
+                    }
+                    else {
+                        tile.minX = std::min(tile.minX, x);
+                        tile.maxX = std::max(tile.maxX, x);
+                        tile.minY = std::min(tile.minY, y);
+                        tile.maxY = std::max(tile.maxY, y);
+                    }
+                    ++count;
+                }
+            }
+        }
+        changed += count;
+    });
+    lastChanged = changed;
+
+    //every tile within the halo of a changed point is filtered again
+    for (int tx = 0; tx < tilesX; ++tx) {
+        for (int ty = 0; ty < tilesY; ++ty) {
+            const Tile& tile = tiles[static_cast<size_t>(tx) * tilesY + ty];
+            if (tile.minX > tile.maxX) continue;
+            const int firstX = std::max(0, tile.minX - halo) / tileRows;
+            const int lastX = std::min(raw.width() - 1, tile.maxX + halo) / tileRows;
+            const int firstY = std::max(0, tile.minY - halo) / tileCols;
+            const int lastY = std::min(raw.height() - 1, tile.maxY + halo) / tileCols;
+            for (int i = firstX; i <= lastX; ++i) {
+                for (int j = firstY; j <= lastY; ++j) {
+                    tiles[static_cast<size_t>(i) * tilesY + j].refilter = true;
+                }
+            }
+        }
+    }
+    dirtyTiles.clear();
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        if (tiles[t].refilter) dirtyTiles.push_back(static_cast<int>(t));
+    }
+}
+
+void IncrementalBilateralFilter::refilterTiles()
+{
+    //one item per worker, each takes tiles from the shared counter with its own window and filter
+    std::atomic<size_t> nextTile{0};
+    std::atomic<size_t> refiltered{0};
+    threadPool.parallelFor(static_cast<int>(workers.size()), 1, [&](int first, int last) {
+        for (int w = first; w < last; ++w) {
+            size_t points = 0;
+            for (size_t t = nextTile++; t < dirtyTiles.size(); t = nextTile++) {
+                const int tile = dirtyTiles[t];
+                const int tx = tile / tilesY, ty = tile % tilesY;
+                points += static_cast<size_t>(std::min(reference.width(), (tx + 1) * tileRows) - tx * tileRows)
+                          * (std::min(reference.height(), (ty + 1) * tileCols) - ty * tileCols);
+                refilterTile(tile, workers[w]);
+            }
+            refiltered += points;
+        }
+    });
+    lastRefiltered = refiltered;
+}
+
+void IncrementalBilateralFilter::refilterTile(int tile, Worker& worker)
+{
+    const int tx = tile / tilesY, ty = tile % tilesY;
+    const int x0 = tx * tileRows, x1 = std::min(reference.width(), x0 + tileRows);
+    const int y0 = ty * tileCols, y1 = std::min(reference.height(), y0 + tileCols);
+    const int windowX0 = std::max(0, x0 - halo), windowX1 = std::min(reference.width(), x1 + halo);
+    const int windowY0 = std::max(0, y0 - windowHaloY), windowY1 = std::min(reference.height(), y1 + windowHaloY);
+
+    //the window holds the reference with the changes taken over, not the raw scan, whose drift below the
+    //tolerance the untouched tiles never saw. The tile in its middle is exact after filtering.
+    OrganizedPointCloud& window = worker.window;
+    window.resize(windowX1 - windowX0, windowY1 - windowY0);
+    copyBlock(reference, windowX0, windowY0, window.width(), window.height(), window, 0, 0);
+    worker.filter->filterPointCloud(window);
+    copyBlock(window, x0 - windowX0, y0 - windowY0, x1 - x0, y1 - y0, filtered, x0, y0);
+}
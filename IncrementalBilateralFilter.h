@@ -0,0 +1,70 @@
+#ifndef INCREMENTALBILATERALFILTER_H
+#define INCREMENTALBILATERALFILTER_H
+
+#include <memory>
+#include <vector>
+#include "BilateralFilter.h"
+#include "OrganizedPointCloud.h"
+#include "ThreadPool.h"
+
+//Re-filters only what changed between consecutive scans of the same scene.
+//The first scan is filtered completely. Every later scan is compared with the reference scan, a point is
+//changed when its validity differs or a coordinate or normal component moved more than the tolerance.
+//Changed points are taken over into the reference, points that moved less than the tolerance keep their
+//reference value, so small drift is not chased.
+//A filtered point depends on the reference points within iterations * radius of it, so only the tiles within
+//that halo of a change are filtered again, each in a window of the reference with the same halo around it.
+//Windows start on 16 point boundaries, so every point sees the same scalar or vector kernel as in a full pass
+//and the result stays bit identical to filtering the whole reference.
+//Comparing is one streaming pass over the scan, the filtering work follows the size of the change.
+class IncrementalBilateralFilter {
+public:
+    IncrementalBilateralFilter(const BilateralFilterConfig& config, float tolerance);
+    ~IncrementalBilateralFilter();
+    IncrementalBilateralFilter(const IncrementalBilateralFilter&) = delete;
+    IncrementalBilateralFilter& operator=(const IncrementalBilateralFilter&) = delete;
+
+    //filtered reference after taking over the changes of raw, valid until the next call
+    const OrganizedPointCloud& filter(const OrganizedPointCloud& raw);
+    //starts from an earlier raw scan and its filtered result, e.g. both read back from disk
+    void setReference(const OrganizedPointCloud& raw, const OrganizedPointCloud& filtered);
+    //the next scan is filtered completely
+    void reset();
+
+    //points of the last scan that differed from the reference
+    size_t changedPoints() const { return lastChanged; }
+    //points of the last scan whose filtered value was computed again
+    size_t refilteredPoints() const { return lastRefiltered; }
+
+private:
+    struct Tile {
+        //bounding box of the changed points of the tile, empty when minX > maxX
+        int minX, maxX, minY, maxY;
+        bool refilter;
+    };
+    //per worker window buffer and single threaded filter
+    struct Worker {
+        std::unique_ptr<BilateralFilter> filter;
+        OrganizedPointCloud window;
+    };
+    void findChanges(const OrganizedPointCloud& raw);
+    void refilterTiles();
+    void refilterTile(int tile, Worker& worker);
+
+    BilateralFilterConfig config;
+    float tolerance;
+    int halo;//rows of input a filtered point depends on
+    int windowHaloY;//halo rounded up to whole vector blocks
+    ThreadPool threadPool;
+    std::vector<Worker> workers;
+    OrganizedPointCloud reference;//raw points the filtered result was computed from
+    OrganizedPointCloud filtered;
+    std::vector<Tile> tiles;
+    std::vector<int> dirtyTiles;
+    int tilesX = 0, tilesY = 0;
+    bool hasReference = false;
+    size_t lastChanged = 0;
+    size_t lastRefiltered = 0;
+};
+
+#endif // INCREMENTALBILATERALFILTER_H
@@ -0,0 +1,699 @@
+//Micro and macro benchmarks of the hot paths on synthetic inputs.
+//Every benchmark runs at 720p, 5MP and 12MP, inputs come from fixed seeds so runs are comparable.
+//Machine-readable output: kivi_bench --benchmark_out=<file> --benchmark_out_format=json
+//(some stages log to stdout, so --benchmark_format=json is only clean for the quiet ones)
+//Benchmarks that also check a property fail through failCheck, kivi_bench then exits with 1 so ctest sees it.
+#include <benchmark/benchmark.h>
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "BilateralFilter.h"
+#include "BlockMatcher.h"
+#include "CompactPointCloud.h"
+#include "CorrespondenceMatching.h"
+#include "DoubleThreeStepPhaseShifting.h"
+#include "PatternGenerator.h"
+#include "PhaseStreamPipeline.h"
+#include "PhaseMatcher.h"
+#include "PlyIO.h"
+#include "Triangulator.h"
+
+//Heap allocations made while countAllocations is set, by any thread. With glibc the malloc family of the
+//executable replaces the one of libc, so operator new, cv::Mat buffers and the aligned point cloud
+//buffers are all counted. Elsewhere heapAllocationsCounted stays false.
+namespace {
+    std::atomic<bool> countAllocations{false};
+    std::atomic<long long> heapAllocations{0};
+
+    void countAllocation()
+    {
+        if (countAllocations.load(std::memory_order_relaxed)) heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+#ifdef __GLIBC__
+const bool heapAllocationsCounted = true;
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* memory, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void* memory);
+
+    void* malloc(size_t size)
+    {
+        countAllocation();
+        return __libc_malloc(size);
+    }
+    void* calloc(size_t count, size_t size)
+    {
+        countAllocation();
+        return __libc_calloc(count, size);
+    }
+    void* realloc(void* memory, size_t size)
+    {
+        countAllocation();
+        return __libc_realloc(memory, size);
+    }
+    void* memalign(size_t alignment, size_t size)
+    {
+        countAllocation();
+        return __libc_memalign(alignment, size);
+    }
+    void* aligned_alloc(size_t alignment, size_t size)
+    {
+        countAllocation();
+        return __libc_memalign(alignment, size);
+    }
+    int posix_memalign(void** memory, size_t alignment, size_t size)
+    {
+        countAllocation();
+        *memory = __libc_memalign(alignment, size);
+        return *memory ? 0 : 12;//ENOMEM
+    }
+    void free(void* memory)
+    {
+        __libc_free(memory);
+    }
+}
+#else
+const bool heapAllocationsCounted = false;
+#endif
+
+//forwards to the private stages of the pipeline classes
+class KiviBenchAccess {
+public:
+    static void generatePatterns(DoubleThreeStepPhaseShifting& p) { p.generatePatterns(); }
+    static std::vector<cv::Mat>& patterns(DoubleThreeStepPhaseShifting& p) { return p.patterns; }
+    static std::vector<cv::Mat>& grayImages(DoubleThreeStepPhaseShifting& p) { return p.grayImages; }
+    static cv::Mat computePhaseMap(DoubleThreeStepPhaseShifting& p, const cv::Mat& i1, const cv::Mat& i2, const cv::Mat& i3)
+    {
+        cv::Mat phaseMap;
+        p.computePhaseMap(i1, i2, i3, phaseMap);
+        return phaseMap;
+    }
+    static void computePhaseMap(DoubleThreeStepPhaseShifting& p, const cv::Mat& i1, const cv::Mat& i2, const cv::Mat& i3, cv::Mat& phaseMap)
+    {
+        p.computePhaseMap(i1, i2, i3, phaseMap);
+    }
+    static void setPhaseMaps(DoubleThreeStepPhaseShifting& p, const cv::Mat& phaseMap1, const cv::Mat& phaseMap2)
+    {
+        p.phaseMap1 = phaseMap1;
+        p.phaseMap2 = phaseMap2;
+    }
+    static void averagePhaseMaps(DoubleThreeStepPhaseShifting& p) { p.averagePhaseMaps(); }
+    static void decodeGrayImages(DoubleThreeStepPhaseShifting& p) { p.decodeGrayImages(); }
+    static void unwrapPhaseMap(DoubleThreeStepPhaseShifting& p) { p.unwrapPhaseMap(); }
+    static int numGrayImages(const DoubleThreeStepPhaseShifting& p) { return p.numGrayImages; }
+
+    static void calculateDisparity(CorrespondenceMatching& m, const cv::Mat& left, const cv::Mat& right, cv::Mat& disparity)
+    {
+        m.calculateDisparity(left, right, disparity);
+    }
+
+    static void applyBilateralFilter(BilateralFilter& f, OrganizedPointCloud& cloud)
+    {
+        f.applyBilateralFilter(cloud, f.iterations, f.spatialSigma, f.rangeSigma);
+    }
+    static OrganizedPointCloud readPLYFileWithNormals(BilateralFilter& f, const std::string& filename, int width, int height)
+    {
+        return f.readPLYFileWithNormals(filename, width, height);
+    }
+    static void writePLYFile(BilateralFilter& f, const std::string& filename, const OrganizedPointCloud& cloud)
+    {
+        f.writePLYFile(filename, cloud);
+    }
+};
+
+namespace {
+    struct Resolution {
+        const char* name;
+        int width, height;
+    };
+    const Resolution resolutions[] = {{"720p", 1280, 720}, {"5MP", 2592, 1944}, {"12MP", 4000, 3000}};
+    const unsigned int seed = 20240501;
+
+    const Resolution& resolution(const benchmark::State& state)
+    {
+        return resolutions[state.range(0)];
+    }
+
+    void setPixels(benchmark::State& state, const Resolution& r)
+    {
+        state.SetLabel(r.name);
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(r.width) * r.height);
+    }
+
+    //SkipWithError only marks the run, the flag turns it into the exit code
+    std::atomic<bool> checkFailed{false};
+
+    void failCheck(benchmark::State& state, const char* message)
+    {
+        checkFailed.store(true);
+        state.SkipWithError(message);
+    }
+
+    //fringes of the pattern generator plus camera noise
+    std::vector<cv::Mat> noisyFringes(DoubleThreeStepPhaseShifting& phaseShifting, std::mt19937& random)
+    {
+        KiviBenchAccess::generatePatterns(phaseShifting);
+        std::vector<cv::Mat> fringes = KiviBenchAccess::patterns(phaseShifting);
+        std::normal_distribution<float> noise(0.0f, 2.0f);
+        for (auto& fringe : fringes) {
+            for (int y = 0; y < fringe.rows; ++y) {
+                uchar* row = fringe.ptr<uchar>(y);
+                for (int x = 0; x < fringe.cols; ++x) row[x] = cv::saturate_cast<uchar>(row[x] + noise(random));
+            }
+        }
+        return fringes;
+    }
+
+    //column Gray codes of the fringe order, 255 for a set bit, with a few flipped pixels
+    std::vector<cv::Mat> grayCodes(int width, int height, int bits, std::mt19937& random)
+    {
+        std::vector<cv::Mat> codes(bits);
+        std::uniform_int_distribution<int> flip(0, 999);
+        for (int k = 0; k < bits; ++k) {
+            codes[k].create(height, width, CV_8UC1);
+            for (int y = 0; y < height; ++y) {
+                uchar* row = codes[k].ptr<uchar>(y);
+                for (int x = 0; x < width; ++x) {
+                    const int order = x * (1 << bits) / width;
+                    const int gray = order ^ (order >> 1);
+                    bool bit = (gray >> (bits - 1 - k)) & 1;
+                    if (flip(random) == 0) bit = !bit;
+                    row[x] = bit ? 255 : 0;
+                }
+            }
+        }
+        return codes;
+    }
+
+    //fringes shifted by stepDegrees, the projected patterns, with camera noise for both sets, and Gray codes of their
+    //fringe order whose edges sit one pixel late, so every edge leaves a pixel for the order correction
+    void consistentPhaseInputs(const Resolution& r, double stepDegrees, int bits, std::vector<cv::Mat>& fringes, std::vector<cv::Mat>& codes,
+                               std::mt19937& random)
+    {
+        const double step = stepDegrees * CV_PI / 180.0;
+        const double wavelength = r.width / 128.0;
+        std::normal_distribution<double> noise(0.0, 2.0);
+        fringes.resize(6);
+        codes.resize(bits);
+        for (auto& fringe : fringes) fringe.create(r.height, r.width, CV_8UC1);
+        for (auto& code : codes) code.create(r.height, r.width, CV_8UC1);
+        for (int y = 0; y < r.height; ++y) {
+            for (int x = 0; x < r.width; ++x) {
+                const double phase = 2 * CV_PI * x / wavelength;
+                for (int k = 0; k < 6; ++k) {
+                    const double value = 127.5 + 100.0 * std::cos(phase + (k % 3 - 1) * step) + noise(random);
+                    fringes[k].at<uchar>(y, x) = cv::saturate_cast<uchar>(value);
+                }
+                const int order = static_cast<int>(std::floor((2 * CV_PI * std::max(0, x - 1) / wavelength + CV_PI) / (2 * CV_PI)));
+                const int gray = order ^ (order >> 1);
+                for (int k = 0; k < bits; ++k) codes[k].at<uchar>(y, x) = (gray >> (bits - 1 - k)) & 1 ? 255 : 0;
+            }
+        }
+    }
+
+    //smooth unwrapped phase ramp, the right map is shifted by a disparity that varies over the image
+    void phaseMaps(const Resolution& r, cv::Mat& left, cv::Mat& right, int type, std::mt19937& random)
+    {
+        std::normal_distribution<double> noise(0.0, 1e-3);
+        left.create(r.height, r.width, type);
+        right.create(r.height, r.width, type);
+        for (int y = 0; y < r.height; ++y) {
+            for (int x = 0; x < r.width; ++x) {
+                const double disparity = 20.0 + 10.0 * std::sin(y * 0.01);
+                const double l = 0.05 * x + noise(random);
+                const double rv = 0.05 * (x + disparity) + noise(random);
+                if (type == CV_64F) {
+                    left.at<double>(y, x) = l;
+                    right.at<double>(y, x) = rv;
+                }
+                else {
+                    left.at<float>(y, x) = static_cast<float>(l);
+                    right.at<float>(y, x) = static_cast<float>(rv);
+                }
+            }
+        }
+    }
+
+    //wavy surface with noisy positions and normals, every point valid
+    OrganizedPointCloud surfaceCloud(const Resolution& r, std::mt19937& random)
+    {
+        OrganizedPointCloud cloud(r.width, r.height);
+        std::normal_distribution<float> noise(0.0f, 0.05f);
+        for (int x = 0; x < r.width; ++x) {
+            for (int y = 0; y < r.height; ++y) {
+                const float z = 1000.0f + 20.0f * std::sin(x * 0.01f) * std::cos(y * 0.01f);
+                cloud.setPoint(cloud.index(x, y), static_cast<float>(x) + noise(random), static_cast<float>(y) + noise(random),
+                               z + noise(random), noise(random), noise(random), 1.0f + noise(random));
+            }
+        }
+        return cloud;
+    }
+
+    std::string temporaryPly(const Resolution& r)
+    {
+        return std::string("kivi_bench_") + r.name + ".ply";
+    }
+
+    //same size and type and the same bits in every pixel, NaN included
+    bool identicalMaps(const cv::Mat& a, const cv::Mat& b)
+    {
+        if (a.size() != b.size() || a.type() != b.type()) return false;
+        const size_t rowBytes = static_cast<size_t>(a.cols) * a.elemSize();
+        for (int y = 0; y < a.rows; ++y) {
+            if (std::memcmp(a.ptr(y), b.ptr(y), rowBytes) != 0) return false;
+        }
+        return true;
+    }
+}
+
+//six fringe and seven Gray-code images, one computed row per pattern copied to every row
+static void BM_generatePatterns(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::vector<cv::Mat> fringes, codes;
+    for (auto _ : state) {
+        PatternGenerator generator(r.width, r.height, 128.0, 60.0);
+        generator.fringePatterns(fringes);
+        generator.grayCodePatterns(codes);
+        benchmark::DoNotOptimize(codes.back().data);
+    }
+    setPixels(state, r);
+}
+
+static void BM_computePhaseMap(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    DoubleThreeStepPhaseShifting phaseShifting(r.width, r.height);
+    std::vector<cv::Mat> fringes = noisyFringes(phaseShifting, random);
+    cv::Mat phase;
+    for (auto _ : state) {
+        KiviBenchAccess::computePhaseMap(phaseShifting, fringes[0], fringes[1], fringes[2], phase);
+        benchmark::DoNotOptimize(phase.data);
+    }
+    setPixels(state, r);
+}
+
+static void BM_averagePhaseMaps(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    DoubleThreeStepPhaseShifting phaseShifting(r.width, r.height);
+    std::vector<cv::Mat> fringes = noisyFringes(phaseShifting, random);
+    KiviBenchAccess::setPhaseMaps(phaseShifting, KiviBenchAccess::computePhaseMap(phaseShifting, fringes[0], fringes[1], fringes[2]),
+                                  KiviBenchAccess::computePhaseMap(phaseShifting, fringes[3], fringes[4], fringes[5]));
+    for (auto _ : state) {
+        KiviBenchAccess::averagePhaseMaps(phaseShifting);
+    }
+    setPixels(state, r);
+}
+
+static void BM_decodeGrayImages(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    DoubleThreeStepPhaseShifting phaseShifting(r.width, r.height);
+    KiviBenchAccess::grayImages(phaseShifting) = grayCodes(r.width, r.height, KiviBenchAccess::numGrayImages(phaseShifting), random);
+    for (auto _ : state) {
+        KiviBenchAccess::decodeGrayImages(phaseShifting);
+    }
+    setPixels(state, r);
+}
+
+static void BM_unwrapPhaseMap(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    DoubleThreeStepPhaseShifting phaseShifting(r.width, r.height);
+    std::vector<cv::Mat> fringes = noisyFringes(phaseShifting, random);
+    KiviBenchAccess::setPhaseMaps(phaseShifting, KiviBenchAccess::computePhaseMap(phaseShifting, fringes[0], fringes[1], fringes[2]),
+                                  KiviBenchAccess::computePhaseMap(phaseShifting, fringes[3], fringes[4], fringes[5]));
+    KiviBenchAccess::averagePhaseMaps(phaseShifting);
+    KiviBenchAccess::grayImages(phaseShifting) = grayCodes(r.width, r.height, KiviBenchAccess::numGrayImages(phaseShifting), random);
+    KiviBenchAccess::decodeGrayImages(phaseShifting);
+    for (auto _ : state) {
+        KiviBenchAccess::unwrapPhaseMap(phaseShifting);
+    }
+    setPixels(state, r);
+}
+
+static void BM_computeUnwrappedPhaseFused(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    DoubleThreeStepPhaseShifting phaseShifting(r.width, r.height);
+    std::vector<cv::Mat> fringes = noisyFringes(phaseShifting, random);
+    std::vector<cv::Mat> codes = grayCodes(r.width, r.height, KiviBenchAccess::numGrayImages(phaseShifting), random);
+    cv::Mat unwrapped;
+    for (auto _ : state) {
+        phaseShifting.computeUnwrappedPhaseFused(fringes, codes, unwrapped);
+    }
+    //the step-by-step path on the same images must give the same map
+    KiviBenchAccess::setPhaseMaps(phaseShifting, KiviBenchAccess::computePhaseMap(phaseShifting, fringes[0], fringes[1], fringes[2]),
+                                  KiviBenchAccess::computePhaseMap(phaseShifting, fringes[3], fringes[4], fringes[5]));
+    KiviBenchAccess::averagePhaseMaps(phaseShifting);
+    KiviBenchAccess::grayImages(phaseShifting) = codes;
+    KiviBenchAccess::decodeGrayImages(phaseShifting);
+    KiviBenchAccess::unwrapPhaseMap(phaseShifting);
+    if (!identicalMaps(unwrapped, phaseShifting.unwrappedPhase())) {
+        failCheck(state, "the fused phase differs from the step-by-step phase");
+    }
+    setPixels(state, r);
+}
+
+//sequences replayed from PNG files, the camera stand-in, through the capture and decode threads of the stream
+static void BM_phaseStream(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    const int bits = PatternGenerator::grayCodeBits(128.0);
+    std::vector<cv::Mat> fringes, codes;
+    consistentPhaseInputs(r, PhaseShiftingConfig().phaseShiftDegrees, bits, fringes, codes, random);
+    const std::string phasePrefix = std::string("kivi_bench_") + r.name + "_phase_";
+    const std::string grayPrefix = std::string("kivi_bench_") + r.name + "_gray_";
+    for (int k = 0; k < 6; ++k) cv::imwrite(phasePrefix + std::to_string(k) + ".png", fringes[k]);
+    for (int k = 0; k < bits; ++k) cv::imwrite(grayPrefix + std::to_string(k) + ".png", codes[k]);
+    const int sequences = 4;
+    for (auto _ : state) {
+        FileSequenceSource source = FileSequenceSource::fromPrefixes(phasePrefix, grayPrefix, bits, sequences);
+        PhaseStreamPipeline pipeline(r.width, r.height, bits);
+        const size_t decoded = pipeline.run(source, [](const cv::Mat&, uint64_t) { return true; });
+        if (decoded != sequences) {
+            failCheck(state, "the stream lost sequences");
+            break;
+        }
+    }
+    for (int k = 0; k < 6; ++k) std::remove((phasePrefix + std::to_string(k) + ".png").c_str());
+    for (int k = 0; k < bits; ++k) std::remove((grayPrefix + std::to_string(k) + ".png").c_str());
+    state.SetLabel(r.name);
+    state.SetItemsProcessed(state.iterations() * sequences * static_cast<int64_t>(r.width) * r.height);
+}
+
+//fused decoding with the modulation mask, and the order correction at every Gray-code edge
+static void BM_computeUnwrappedPhaseQuality(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    PhaseShiftingConfig config;
+    config.width = r.width;
+    config.height = r.height;
+    config.formula = PhaseFormula::GeneralStep;
+    config.minModulation = 20.0f;
+    config.orderCorrectionRadius = 3;
+    DoubleThreeStepPhaseShifting phaseShifting(config);
+    std::vector<cv::Mat> fringes, codes;
+    consistentPhaseInputs(r, config.phaseShiftDegrees, KiviBenchAccess::numGrayImages(phaseShifting), fringes, codes, random);
+    cv::Mat unwrapped;
+    for (auto _ : state) {
+        phaseShifting.computeUnwrappedPhaseFused(fringes, codes, unwrapped);
+    }
+    setPixels(state, r);
+}
+
+static void BM_calculateDisparity(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    cv::Mat left, right;
+    phaseMaps(r, left, right, CV_64F, random);
+    CorrespondenceMatching matcher;
+    cv::Mat disparity;
+    for (auto _ : state) {
+        KiviBenchAccess::calculateDisparity(matcher, left, right, disparity);
+        benchmark::DoNotOptimize(disparity.data);
+    }
+    setPixels(state, r);
+}
+
+static void BM_phaseMatching(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    cv::Mat left, right, disparity;
+    phaseMaps(r, left, right, CV_32F, random);
+    const PhaseMatcher matcher(0.0f, 64.0f);
+    for (auto _ : state) {
+        matcher.match(left, right, disparity);
+    }
+    setPixels(state, r);
+}
+
+static void BM_blockMatching(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    cv::Mat left, right, disparity;
+    phaseMaps(r, left, right, CV_32F, random);
+    const BlockMatcher matcher(5, 64);
+    for (auto _ : state) {
+        matcher.match(left, right, disparity);
+    }
+    setPixels(state, r);
+}
+
+static void BM_applyBilateralFilter(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    const OrganizedPointCloud input = surfaceCloud(r, random);
+    OrganizedPointCloud cloud;
+    BilateralFilter filter;
+    for (auto _ : state) {
+        state.PauseTiming();
+        cloud.copyFrom(input);
+        state.ResumeTiming();
+        KiviBenchAccess::applyBilateralFilter(filter, cloud);
+    }
+    setPixels(state, r);
+}
+
+//the 720p filter with 1, 2, 4 and 8 threads, fails when a thread count changes the result of one thread
+static void BM_applyBilateralFilterThreads(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    const int threads = static_cast<int>(state.range(1));
+    std::mt19937 random(seed);
+    const OrganizedPointCloud input = surfaceCloud(r, random);
+    OrganizedPointCloud serial, cloud;
+    serial.copyFrom(input);
+    BilateralFilterConfig config;
+    config.threads = 1;
+    BilateralFilter serialFilter("", "", config);
+    serialFilter.filterPointCloud(serial);
+    config.threads = threads;
+    BilateralFilter filter("", "", config);
+    for (auto _ : state) {
+        state.PauseTiming();
+        cloud.copyFrom(input);
+        state.ResumeTiming();
+        KiviBenchAccess::applyBilateralFilter(filter, cloud);
+    }
+    if (!cloud.identicalTo(serial)) {
+        failCheck(state, "the thread count changed the filtered cloud");
+    }
+    setPixels(state, r);
+    state.SetLabel(std::string(r.name) + " " + std::to_string(threads) + " threads");
+}
+
+//one separable 11x11 pass weighted by 3D distance and normals, the replacement for 10 iterations of 3x3
+static void BM_applyBilateralFilterWide(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    const OrganizedPointCloud input = surfaceCloud(r, random);
+    OrganizedPointCloud cloud;
+    BilateralFilterConfig config;
+    config.radius = 5;
+    config.iterations = 1;
+    config.spatialSigma = 3.0f;
+    config.distanceSigma = 2.0f;
+    config.rangeSigma = 0.3f;
+    BilateralFilter filter("", "", config);
+    for (auto _ : state) {
+        state.PauseTiming();
+        cloud.copyFrom(input);
+        state.ResumeTiming();
+        KiviBenchAccess::applyBilateralFilter(filter, cloud);
+    }
+    setPixels(state, r);
+}
+
+//the 10 iterations of BM_applyBilateralFilter on depth and octahedral normals, 8 instead of 24 bytes per point
+static void BM_filterCompactPointCloud(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    CameraIntrinsics intrinsics;
+    intrinsics.cx = r.width / 2.0f;
+    intrinsics.cy = r.height / 2.0f;
+    CompactPointCloud input;
+    input.fromCloud(surfaceCloud(r, random), intrinsics);
+    CompactPointCloud cloud;
+    BilateralFilter filter;
+    for (auto _ : state) {
+        state.PauseTiming();
+        cloud = input;
+        state.ResumeTiming();
+        filter.filterPointCloud(cloud);
+    }
+    setPixels(state, r);
+}
+
+//fused decoding, phase matching, triangulation and bilateral filtering of one frame with the buffers of the
+//previous frame, fails when a frame after the warm-up touches the heap
+static void BM_steadyStateFrame(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    if (!heapAllocationsCounted) {
+        state.SkipWithError("allocation counting needs glibc");
+        return;
+    }
+    std::mt19937 random(seed);
+    PhaseShiftingConfig config;
+    config.width = r.width;
+    config.height = r.height;
+    DoubleThreeStepPhaseShifting phaseShifting(config);
+    std::vector<cv::Mat> fringes, codes;
+    consistentPhaseInputs(r, config.phaseShiftDegrees, KiviBenchAccess::numGrayImages(phaseShifting), fringes, codes, random);
+    cv::Mat left, right;
+    phaseMaps(r, left, right, CV_32F, random);
+    FrameArena arena;
+    phaseShifting.setArena(&arena);
+    const PhaseMatcher matcher(0.0f, 64.0f);
+    CameraIntrinsics intrinsics;
+    intrinsics.cx = r.width / 2.0f;
+    intrinsics.cy = r.height / 2.0f;
+    const Triangulator triangulator(intrinsics);
+    BilateralFilter filter;
+    cv::Mat unwrapped, disparity;
+    OrganizedPointCloud cloud;
+    auto frame = [&]() {
+        phaseShifting.computeUnwrappedPhaseFused(fringes, codes, unwrapped);
+        arena.reset();
+        matcher.match(left, right, disparity, &arena);
+        arena.reset();
+        triangulator.triangulate(disparity, cloud);
+        filter.filterPointCloud(cloud);
+    };
+    //the OpenCV thread pool allocates the job of every parallel loop, the stages are checked on the calling thread
+    const int openCvThreads = cv::getNumThreads();
+    cv::setNumThreads(1);
+    const int warmUpFrames = 2;
+    for (int i = 0; i < warmUpFrames; ++i) frame();
+    long long allocations = 0;
+    for (auto _ : state) {
+        heapAllocations.store(0, std::memory_order_relaxed);
+        countAllocations.store(true, std::memory_order_relaxed);
+        frame();
+        countAllocations.store(false, std::memory_order_relaxed);
+        allocations += heapAllocations.load(std::memory_order_relaxed);
+    }
+    cv::setNumThreads(openCvThreads);
+    state.counters["allocations_per_frame"] = benchmark::Counter(static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+    if (allocations > 0) {
+        failCheck(state, "steady-state frame allocated on the heap");
+    }
+    setPixels(state, r);
+}
+
+//file to file in bands of 64 rows, fails when the result differs from filtering the whole mesh in memory
+static void BM_processFilterStreaming(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    const std::string inputFilename = temporaryPly(r);
+    const std::string outputFilename = std::string("kivi_bench_") + r.name + "_streamed.ply";
+    OrganizedPointCloud expected = surfaceCloud(r, random);
+    PlyWriter::write(inputFilename, expected, true, PlyFormat::BinaryLittleEndian);
+    BilateralFilterConfig config;
+    config.width = r.width;
+    config.height = r.height;
+    config.organizedOutput = true;
+    config.streamingBandRows = 64;
+    BilateralFilter filter(inputFilename, outputFilename, config);
+    size_t validPoints = 0;
+    for (auto _ : state) {
+        if (!filter.processFilterStreaming(validPoints)) {
+            failCheck(state, "streaming the mesh failed");
+            break;
+        }
+    }
+    BilateralFilter("", "", config).filterPointCloud(expected);
+    OrganizedPointCloud streamed;
+    if (!BilateralFilter(outputFilename, "", config).loadPointCloud(streamed) || !streamed.identicalTo(expected)) {
+        failCheck(state, "the streamed mesh differs from the in-memory filter");
+    }
+    std::remove(inputFilename.c_str());
+    std::remove(outputFilename.c_str());
+    setPixels(state, r);
+}
+
+static void BM_readPLYFileWithNormals(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    const std::string filename = temporaryPly(r);
+    PlyWriter::write(filename, surfaceCloud(r, random), false, PlyFormat::BinaryLittleEndian);
+    BilateralFilter filter;
+    for (auto _ : state) {
+        OrganizedPointCloud cloud = KiviBenchAccess::readPLYFileWithNormals(filter, filename, r.width, r.height);
+        benchmark::DoNotOptimize(cloud.validMask());
+    }
+    std::remove(filename.c_str());
+    setPixels(state, r);
+}
+
+static void BM_writePLYFile(benchmark::State& state)
+{
+    const Resolution& r = resolution(state);
+    std::mt19937 random(seed);
+    const std::string filename = temporaryPly(r);
+    const OrganizedPointCloud cloud = surfaceCloud(r, random);
+    BilateralFilter filter;
+    for (auto _ : state) {
+        KiviBenchAccess::writePLYFile(filter, filename, cloud);
+    }
+    std::remove(filename.c_str());
+    setPixels(state, r);
+}
+
+#define KIVI_BENCHMARK(name) BENCHMARK(name)->DenseRange(0, 2)->Unit(benchmark::kMillisecond)->UseRealTime()
+
+KIVI_BENCHMARK(BM_generatePatterns);
+KIVI_BENCHMARK(BM_computePhaseMap);
+KIVI_BENCHMARK(BM_averagePhaseMaps);
+KIVI_BENCHMARK(BM_decodeGrayImages);
+KIVI_BENCHMARK(BM_unwrapPhaseMap);
+KIVI_BENCHMARK(BM_computeUnwrappedPhaseFused);
+KIVI_BENCHMARK(BM_phaseStream);
+KIVI_BENCHMARK(BM_computeUnwrappedPhaseQuality);
+KIVI_BENCHMARK(BM_calculateDisparity);
+KIVI_BENCHMARK(BM_phaseMatching);
+KIVI_BENCHMARK(BM_blockMatching);
+KIVI_BENCHMARK(BM_applyBilateralFilter);
+BENCHMARK(BM_applyBilateralFilterThreads)->ArgsProduct({{0}, {1, 2, 4, 8}})->Unit(benchmark::kMillisecond)->UseRealTime();
+KIVI_BENCHMARK(BM_applyBilateralFilterWide);
+KIVI_BENCHMARK(BM_filterCompactPointCloud);
+KIVI_BENCHMARK(BM_steadyStateFrame);
+KIVI_BENCHMARK(BM_processFilterStreaming);
+KIVI_BENCHMARK(BM_readPLYFileWithNormals);
+KIVI_BENCHMARK(BM_writePLYFile);
+
+int main(int argc, char** argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return checkFailed.load() ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+#include "KiviPipeline.h"
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include "IncrementalBilateralFilter.h"
+#include "Trace.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace {
+    double processCpuSeconds()
+    {
+#ifndef _WIN32
+        timespec now;
+        if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now) == 0) {
+            return static_cast<double>(now.tv_sec) + now.tv_nsec * 1e-9;
+        }
+#endif
+        return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+    }
+
+    long peakRssKb()
+    {
+#ifndef _WIN32
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+            return usage.ru_maxrss / 1024;//bytes on macOS
+#else
+            return usage.ru_maxrss;
+#endif
+        }
+#endif
+        return 0;
+    }
+}
+
+KiviPipeline::KiviPipeline(const PipelineConfig& config)
+        : config(config) {}
+
+template<typename Body>
+bool KiviPipeline::runStage(const std::string& name, const std::string& unit, Body body)
+{
+    KIVI_TRACE_SCOPE(Trace::enabled() ? Trace::intern(name) : nullptr);
+    StageMetrics metrics;
+    metrics.name = name;
+    metrics.unit = unit;
+    const double cpuStart = processCpuSeconds();
+    const auto wallStart = std::chrono::steady_clock::now();
+    double items;
+    try {
+        items = body();
+    }
+    catch (const cv::Exception& error) {
+        //a failed OpenCV check ends the stage like any other failure instead of the process
+        std::cerr << error.what() << std::endl;
+        items = -1.0;
+    }
+    arena.reset();
+    metrics.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    metrics.cpuSeconds = processCpuSeconds() - cpuStart;
+    metrics.peakRssKb = peakRssKb();
+    metrics.items = items < 0.0 ? 0.0 : items;
+    stageMetrics.push_back(metrics);
+    if (items < 0.0) {
+        std::cerr << "Pipeline stage failed: " << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+CameraIntrinsics KiviPipeline::gridIntrinsics(int width, int height) const
+{
+    CameraIntrinsics intrinsics = config.intrinsics;
+    if (config.principalPointAtCenter) {
+        intrinsics.cx = width / 2.0f;
+        intrinsics.cy = height / 2.0f;
+    }
+    return intrinsics;
+}
+
+bool KiviPipeline::run()
+{
+    stageMetrics.clear();
+    succeeded = false;
+    if (!config.compactOutput.empty() && (config.leftPhaseMap.empty() || config.rightPhaseMap.empty())) {
+        //the compact form keeps depth only and rebuilds x and y from the intrinsics, a PLY mesh would lose its own
+        std::cerr << "--compact-out needs a cloud triangulated from --left and --right phase maps" << std::endl;
+        return false;
+    }
+    const bool streaming = config.bilateral.streamingBandRows > 0;
+    if (streaming && (config.inputPly.empty() || config.outputPly.empty() || !config.filter || !config.leftPhaseMap.empty()
+                      || !config.rightPhaseMap.empty() || !config.referenceRawPly.empty() || !config.compactOutput.empty())) {
+        //the bands go from file to file, there is no cloud in memory for the other stages
+        std::cerr << "--stream-bands filters --ply-in into --ply-out, without phase maps, --reference, --compact-out or --no-filter" << std::endl;
+        return false;
+    }
+    if (!config.patternOutput.empty()) {
+        bool ok = runStage("pattern_generation", "patterns", [&]() -> double {
+            const PhaseShiftingConfig& phase = config.phaseShifting;
+            if (phase.width <= 0 || phase.height <= 0) {
+                std::cerr << "The projector sequence needs a pattern size" << std::endl;
+                return -1.0;
+            }
+            PatternGenerator generator(phase.width, phase.height, phase.fringes, phase.phaseShiftDegrees);
+            generator.setCacheDirectory(phase.patternCacheDirectory);
+            return generator.writeSequence(config.patternOutput) ? 6.0 + generator.grayCodeCount() : -1.0;
+        });
+        if (!ok) return false;
+    }
+    if (config.decodePhase) {
+        bool ok = runStage("phase_decoding", "pixels", [&]() -> double {
+            DoubleThreeStepPhaseShifting phaseShifting(config.phaseShifting);
+            phaseShifting.setArena(&arena);
+            phaseShifting.setHeadless(config.headless);
+            phaseShifting.setPhaseMode(DoubleThreeStepPhaseShifting::PhaseMode::Fused);
+            if (!phaseShifting.processPhaseShift()) return -1.0;
+            if (!config.phaseOutput.empty() && !phaseShifting.writePhaseMap(config.phaseOutput)) return -1.0;
+            return static_cast<double>(phaseShifting.unwrappedPhase().total());
+        });
+        if (!ok) return false;
+    }
+
+    const bool match = !config.leftPhaseMap.empty() && !config.rightPhaseMap.empty();
+    if (match) {
+        bool ok = runStage("correspondence", "pixels", [&]() -> double {
+            if (config.matchingMethod == CorrespondenceMatching::MatchingMethod::ExactMatch) {
+                //a 0/1 mask of equal pixels, triangulating it would give a meaningless cloud
+                std::cerr << "The exact method gives no disparity to triangulate, use phase or block" << std::endl;
+                return -1.0;
+            }
+            CorrespondenceMatching matcher;
+            matcher.setArena(&arena);
+            matcher.setHeadless(config.headless);
+            matcher.setMatchingMethod(config.matchingMethod);
+            disparity = matcher.computeDisparity(config.leftPhaseMap, config.rightPhaseMap);
+            if (disparity.empty()) return -1.0;
+            if (disparity.type() != CV_32FC1) disparity.convertTo(disparity, CV_32F);
+            return static_cast<double>(disparity.total());
+        });
+        ok = ok && runStage("triangulation", "points", [&]() -> double {
+            Triangulator(gridIntrinsics(disparity.cols, disparity.rows)).triangulate(disparity, cloud);
+            return static_cast<double>(cloud.size());
+        });
+        if (!ok) return false;
+    }
+
+    BilateralFilter bilateralFilter(config.inputPly, config.outputPly, config.bilateral);
+    if (streaming) {
+        bool ok = runStage("bilateral_filter_streaming", "points", [&]() -> double {
+            size_t validPoints = 0;
+            return bilateralFilter.processFilterStreaming(validPoints) ? static_cast<double>(validPoints) : -1.0;
+        });
+        succeeded = ok;
+        return ok;
+    }
+    if (!match && !config.inputPly.empty()) {
+        bool ok = runStage("ply_read", "points", [&]() -> double {
+            return bilateralFilter.loadPointCloud(cloud) ? static_cast<double>(cloud.size()) : -1.0;
+        });
+        if (!ok) return false;
+    }
+    const bool incremental = !config.referenceRawPly.empty() && !config.referenceFilteredPly.empty();
+    if (config.filter && !cloud.empty() && incremental) {
+        IncrementalBilateralFilter incrementalFilter(config.bilateral, config.changeTolerance);
+        bool ok = runStage("reference_read", "points", [&]() -> double {
+            OrganizedPointCloud referenceRaw, referenceFiltered;
+            if (!BilateralFilter(config.referenceRawPly, "", config.bilateral).loadPointCloud(referenceRaw)) return -1.0;
+            if (!BilateralFilter(config.referenceFilteredPly, "", config.bilateral).loadPointCloud(referenceFiltered)) return -1.0;
+            incrementalFilter.setReference(referenceRaw, referenceFiltered);
+            return static_cast<double>(referenceRaw.size() + referenceFiltered.size());
+        });
+        ok = ok && runStage("bilateral_filter", "points", [&]() -> double {
+            cloud.copyFrom(incrementalFilter.filter(cloud));
+            std::cout << "Incremental filter: " << incrementalFilter.changedPoints() << " changed points, "
+                      << incrementalFilter.refilteredPoints() << " points filtered again" << std::endl;
+            return static_cast<double>(incrementalFilter.refilteredPoints());
+        });
+        if (!ok) return false;
+    }
+    else if (config.filter && !cloud.empty() && config.compactOutput.empty()) {
+        bool ok = runStage("bilateral_filter", "points", [&]() -> double {
+            bilateralFilter.filterPointCloud(cloud);
+            return static_cast<double>(cloud.size());
+        });
+        if (!ok) return false;
+    }
+    if (!config.compactOutput.empty() && !cloud.empty()) {
+        CompactPointCloud compactCloud;
+        bool ok = runStage("compact_encode", "points", [&]() -> double {
+            compactCloud.fromCloud(cloud, gridIntrinsics(cloud.width(), cloud.height()));
+            return static_cast<double>(compactCloud.size());
+        });
+        if (ok && config.filter && !incremental) {
+            ok = runStage("bilateral_filter", "points", [&]() -> double {
+                return bilateralFilter.filterPointCloud(compactCloud) ? static_cast<double>(compactCloud.size()) : -1.0;
+            });
+        }
+        ok = ok && runStage("compact_write", "points", [&]() -> double {
+            return compactCloud.write(config.compactOutput) ? static_cast<double>(compactCloud.size()) : -1.0;
+        });
+        if (ok && !config.outputPly.empty()) {
+            ok = runStage("compact_decode", "points", [&]() -> double {
+                compactCloud.toCloud(cloud);
+                return static_cast<double>(cloud.size());
+            });
+        }
+        if (!ok) return false;
+    }
+    if (!config.outputPly.empty() && !cloud.empty()) {
+        bool ok = runStage("ply_write", "points", [&]() -> double {
+            return bilateralFilter.savePointCloud(cloud) ? static_cast<double>(cloud.size()) : -1.0;
+        });
+        if (!ok) return false;
+    }
+    succeeded = true;
+    return true;
+}
+
+void KiviPipeline::writeMetricsJson(std::ostream& out) const
+{
+    double totalWall = 0.0;
+    for (const auto& stage : stageMetrics) totalWall += stage.wallSeconds;
+    out << "{\n  \"success\": " << (succeeded ? "true" : "false") << ",\n  \"total_wall_s\": " << totalWall << ",\n  \"stages\": [";
+    for (size_t i = 0; i < stageMetrics.size(); ++i) {
+        const StageMetrics& stage = stageMetrics[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << stage.name << "\", \"wall_s\": " << stage.wallSeconds
+            << ", \"cpu_s\": " << stage.cpuSeconds << ", \"peak_rss_kb\": " << stage.peakRssKb
+            << ", \"items\": " << stage.items << ", \"unit\": \"" << stage.unit
+            << "\", \"throughput_per_s\": " << (stage.wallSeconds > 0.0 ? stage.items / stage.wallSeconds : 0.0) << "}";
+    }
+    out << "\n  ]\n}\n";
+}
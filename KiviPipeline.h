@@ -0,0 +1,84 @@
+#ifndef KIVIPIPELINE_H
+#define KIVIPIPELINE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "BilateralFilter.h"
+#include "CorrespondenceMatching.h"
+#include "DoubleThreeStepPhaseShifting.h"
+#include "FrameArena.h"
+#include "OrganizedPointCloud.h"
+#include "Triangulator.h"
+
+//Inputs and outputs of one pipeline run. Stages without their inputs are skipped.
+struct PipelineConfig {
+    //phase decoding of the generated fringes and the captured Gray-code images
+    bool decodePhase = false;
+    PhaseShiftingConfig phaseShifting;
+    std::string phaseOutput;//optional .kphm file of the unwrapped phase
+    //directory for the projector sequence of phaseShifting, fringe_pattern_<k>.png and gray_pattern_<k>.png
+    std::string patternOutput;
+    //correspondence and triangulation, run when both phase maps are given
+    std::string leftPhaseMap;
+    std::string rightPhaseMap;
+    //Phase or BlockMatching, ExactMatch gives no disparity and fails the stage
+    CorrespondenceMatching::MatchingMethod matchingMethod = CorrespondenceMatching::MatchingMethod::Phase;
+    CameraIntrinsics intrinsics;
+    bool principalPointAtCenter = true;//ignores intrinsics.cx and cy and uses the image center
+    //bilateral filtering of the triangulated cloud, or of inputPly when no correspondence ran.
+    //With bilateral.streamingBandRows inputPly goes to outputPly band by band and is never loaded whole.
+    bool filter = true;
+    std::string inputPly;
+    std::string outputPly;
+    BilateralFilterConfig bilateral;
+    //earlier raw scan and its filtered result, only tiles around points that moved more than changeTolerance are filtered again
+    std::string referenceRawPly;
+    std::string referenceFilteredPly;
+    float changeTolerance = 1e-4f;
+    //optional .kpc file, the cloud is kept as depth, octahedral normal and validity bit on the camera grid
+    //and filtered in that form. x and y of --ply-out are then recomputed from the depth and the intrinsics,
+    //so it needs a triangulated cloud and the 8-neighbor float kernel, PLY input is rejected.
+    std::string compactOutput;
+    //no windows and no waitKey, for servers without a display
+    bool headless = false;
+};
+
+//Resource use of one stage. CPU time is summed over all threads of the process, peak RSS is the
+//high-water mark of the process when the stage ended.
+struct StageMetrics {
+    std::string name;
+    double wallSeconds = 0.0;
+    double cpuSeconds = 0.0;
+    long peakRssKb = 0;
+    double items = 0.0;
+    std::string unit;
+};
+
+//Chains phase decoding, correspondence, triangulation and bilateral filtering in memory.
+class KiviPipeline {
+public:
+    explicit KiviPipeline(const PipelineConfig& config);
+    //false as soon as a stage fails, the metrics of the stages that ran stay available
+    bool run();
+    const std::vector<StageMetrics>& metrics() const { return stageMetrics; }
+    //{"success": ..., "total_wall_s": ..., "stages": [{"name", "wall_s", "cpu_s", "peak_rss_kb", "items", "unit", "throughput_per_s"}]}
+    void writeMetricsJson(std::ostream& out) const;
+
+private:
+    //body returns the number of processed items, or a negative value on failure
+    template<typename Body>
+    bool runStage(const std::string& name, const std::string& unit, Body body);
+    //configured intrinsics, with the principal point at the center of a width x height grid when requested
+    CameraIntrinsics gridIntrinsics(int width, int height) const;
+
+    PipelineConfig config;
+    std::vector<StageMetrics> stageMetrics;
+    OrganizedPointCloud cloud;
+    cv::Mat disparity;
+    //scratch of the stages, taken back after every stage so a repeated run() allocates no more than the first
+    FrameArena arena;
+    bool succeeded = false;
+};
+
+#endif // KIVIPIPELINE_H
@@ -0,0 +1,134 @@
+#include "MappedFile.h"
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other) {
+        close();
+        std::swap(mapped, other.mapped);
+        std::swap(fileSize, other.fileSize);
+        std::swap(opened, other.opened);
+#ifdef _WIN32
+        std::swap(fileHandle, other.fileHandle);
+        std::swap(mappingHandle, other.mappingHandle);
+#endif
+    }
+    return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    fileSize = static_cast<size_t>(size.QuadPart);
+    opened = true;
+    if (fileSize == 0) return true;//empty files can not be mapped
+    mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle) {
+        mapped = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!mapped) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::release(size_t end)
+{
+    //a read-only view only holds clean pages, the working set trimming of Windows reclaims them
+    (void)end;
+}
+
+void MappedFile::close()
+{
+    if (mapped) UnmapViewOfFile(mapped);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle) CloseHandle(fileHandle);
+    mapped = nullptr;
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+    fileSize = 0;
+    opened = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    fileSize = static_cast<size_t>(info.st_size);
+    opened = true;
+    if (fileSize > 0) {
+        void* memory = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (memory == MAP_FAILED) {
+            ::close(fd);
+            close();
+            return false;
+        }
+        //files are parsed front to back
+        madvise(memory, fileSize, MADV_SEQUENTIAL);
+        mapped = memory;
+    }
+    //the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::release(size_t end)
+{
+    if (!mapped) return;
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    end = std::min(end, fileSize) / page * page;
+    if (end > 0) {
+        madvise(mapped, end, MADV_DONTNEED);
+    }
+}
+
+void MappedFile::close()
+{
+    if (mapped) munmap(mapped, fileSize);
+    mapped = nullptr;
+    fileSize = 0;
+    opened = false;
+}
+
+#endif
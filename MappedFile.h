@@ -0,0 +1,35 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+//Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    bool open(const std::string& filename);
+    void close();
+    bool isOpen() const { return mapped != nullptr || (opened && fileSize == 0); }
+    const char* data() const { return static_cast<const char*>(mapped); }
+    size_t size() const { return fileSize; }
+    //drops the resident pages of [0, end) so streamed files do not stay in memory, they are read again on access
+    void release(size_t end);
+
+private:
+    void* mapped = nullptr;
+    size_t fileSize = 0;
+    bool opened = false;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,160 @@
+#include "OrganizedPointCloud.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <new>
+
+namespace {
+    constexpr size_t alignment = 64;
+    size_t alignUp(size_t value, size_t to) { return (value + to - 1) / to * to; }
+}
+
+OrganizedPointCloud::OrganizedPointCloud(int width, int height)
+{
+    resize(width, height);
+    clear();
+}
+
+OrganizedPointCloud::OrganizedPointCloud(const OrganizedPointCloud& other)
+{
+    copyFrom(other);
+}
+
+OrganizedPointCloud& OrganizedPointCloud::operator=(const OrganizedPointCloud& other)
+{
+    if (this != &other) {
+        copyFrom(other);
+    }
+    return *this;
+}
+
+OrganizedPointCloud::OrganizedPointCloud(OrganizedPointCloud&& other) noexcept
+{
+    swap(other);
+}
+
+OrganizedPointCloud& OrganizedPointCloud::operator=(OrganizedPointCloud&& other) noexcept
+{
+    swap(other);
+    return *this;
+}
+
+void OrganizedPointCloud::allocate(size_t points)
+{
+    if (planes && points <= planeStride) return;
+    size_t stride = alignUp(std::max<size_t>(points, 1), alignment / sizeof(float));
+    size_t bytes = ChannelCount * stride * sizeof(float) + alignUp(stride, alignment);
+    void* memory = std::aligned_alloc(alignment, bytes);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    storage.reset(static_cast<unsigned char*>(memory));
+    capacityBytes = bytes;
+    //planes are laid out back to back, the mask follows the last plane
+    planeStride = stride;
+    planes = reinterpret_cast<float*>(storage.get());
+    mask = storage.get() + ChannelCount * stride * sizeof(float);
+}
+
+void OrganizedPointCloud::resize(int width, int height)
+{
+    allocate(static_cast<size_t>(width) * height);
+    cloudWidth = width;
+    cloudHeight = height;
+}
+
+void OrganizedPointCloud::reserve(size_t points)
+{
+    allocate(points);
+}
+
+void OrganizedPointCloud::dropRows(int rows)
+{
+    rows = std::min(std::max(rows, 0), cloudWidth);
+    if (rows == 0) return;
+    const size_t offset = static_cast<size_t>(rows) * cloudHeight;
+    const size_t remaining = size() - offset;
+    for (int c = 0; c < ChannelCount; ++c) {
+        std::memmove(channel(c), channel(c) + offset, remaining * sizeof(float));
+    }
+    std::memmove(mask, mask + offset, remaining);
+    cloudWidth -= rows;
+}
+
+void OrganizedPointCloud::clear()
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (int c = 0; c < ChannelCount; ++c) {
+        std::fill_n(channel(c), size(), nan);
+    }
+    std::memset(mask, 0, size());
+}
+
+void OrganizedPointCloud::swap(OrganizedPointCloud& other) noexcept
+{
+    std::swap(storage, other.storage);
+    std::swap(capacityBytes, other.capacityBytes);
+    std::swap(planeStride, other.planeStride);
+    std::swap(planes, other.planes);
+    std::swap(mask, other.mask);
+    std::swap(cloudWidth, other.cloudWidth);
+    std::swap(cloudHeight, other.cloudHeight);
+}
+
+void OrganizedPointCloud::copyFrom(const OrganizedPointCloud& other)
+{
+    if (this == &other) return;
+    resize(other.width(), other.height());
+    for (int c = 0; c < ChannelCount; ++c) {
+        std::memcpy(channel(c), other.channel(c), size() * sizeof(float));
+    }
+    copyMaskFrom(other);
+}
+
+void OrganizedPointCloud::copyMaskFrom(const OrganizedPointCloud& other)
+{
+    std::memcpy(mask, other.validMask(), std::min(size(), other.size()));
+}
+
+void OrganizedPointCloud::setPoint(size_t i, float x, float y, float z, float nx, float ny, float nz)
+{
+    planes[i] = x;
+    planes[planeStride + i] = y;
+    planes[2 * planeStride + i] = z;
+    planes[3 * planeStride + i] = nx;
+    planes[4 * planeStride + i] = ny;
+    planes[5 * planeStride + i] = nz;
+    mask[i] = 1;
+}
+
+void OrganizedPointCloud::setInvalid(size_t i)
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (int c = 0; c < ChannelCount; ++c) {
+        planes[c * planeStride + i] = nan;
+    }
+    mask[i] = 0;
+}
+
+size_t OrganizedPointCloud::validCount() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < size(); ++i) {
+        count += mask[i] != 0;
+    }
+    return count;
+}
+
+bool OrganizedPointCloud::identicalTo(const OrganizedPointCloud& other) const
+{
+    if (cloudWidth != other.cloudWidth || cloudHeight != other.cloudHeight) return false;
+    if (size() > 0 && std::memcmp(mask, other.mask, size()) != 0) return false;
+    for (int c = 0; c < ChannelCount; ++c) {
+        const float* a = channel(c);
+        const float* b = other.channel(c);
+        for (size_t i = 0; i < size(); ++i) {
+            if (mask[i] && std::memcmp(a + i, b + i, sizeof(float)) != 0) return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,75 @@
+#ifndef ORGANIZEDPOINTCLOUD_H
+#define ORGANIZEDPOINTCLOUD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+
+//Organized point cloud stored as structure of arrays.
+//x,y,z,nx,ny,nz and the validity mask each live in their own contiguous, 64-byte aligned plane.
+//Point (x, y) of the width x height grid is at index x * height + y, which is the vertex order of the PLY file.
+class OrganizedPointCloud {
+public:
+    enum Channel { X = 0, Y, Z, NX, NY, NZ, ChannelCount };
+
+    OrganizedPointCloud() = default;
+    OrganizedPointCloud(int width, int height);
+    OrganizedPointCloud(const OrganizedPointCloud& other);
+    OrganizedPointCloud& operator=(const OrganizedPointCloud& other);
+    OrganizedPointCloud(OrganizedPointCloud&& other) noexcept;
+    OrganizedPointCloud& operator=(OrganizedPointCloud&& other) noexcept;
+
+    //keeps the current allocation and the stored points when the capacity is large enough,
+    //otherwise reallocates and the contents are undefined
+    void resize(int width, int height);
+    //makes room for points without changing the dimensions, existing contents are undefined afterwards
+    void reserve(size_t points);
+    //removes the first rows and moves the remaining ones to the front, used by sliding windows
+    void dropRows(int rows);
+    //marks every point invalid and fills the planes with NaN
+    void clear();
+    //O(1) exchange of the buffers, used for ping-pong iterations
+    void swap(OrganizedPointCloud& other) noexcept;
+    void copyFrom(const OrganizedPointCloud& other);
+    void copyMaskFrom(const OrganizedPointCloud& other);
+
+    int width() const { return cloudWidth; }
+    int height() const { return cloudHeight; }
+    size_t size() const { return static_cast<size_t>(cloudWidth) * cloudHeight; }
+    bool empty() const { return size() == 0; }
+    size_t index(int x, int y) const { return static_cast<size_t>(x) * cloudHeight + y; }
+
+    float* channel(int c) { return planes + c * planeStride; }
+    const float* channel(int c) const { return planes + c * planeStride; }
+    uint8_t* validMask() { return mask; }
+    const uint8_t* validMask() const { return mask; }
+    bool isValid(size_t i) const { return mask[i] != 0; }
+
+    void setPoint(size_t i, float x, float y, float z, float nx, float ny, float nz);
+    void setInvalid(size_t i);
+    size_t validCount() const;
+    //same size and validity, and bit identical channels at every valid point
+    bool identicalTo(const OrganizedPointCloud& other) const;
+    //bytes held by the planes and the mask
+    size_t memoryFootprint() const { return capacityBytes; }
+    size_t capacity() const { return planeStride; }
+
+private:
+    struct FreeDeleter {
+        void operator()(void* p) const { std::free(p); }
+    };
+    void allocate(size_t points);//reallocates when points exceed the capacity
+
+    std::unique_ptr<unsigned char, FreeDeleter> storage;
+    size_t capacityBytes = 0;
+    size_t planeStride = 0;//floats between the starts of two planes
+    float* planes = nullptr;
+    uint8_t* mask = nullptr;
+    int cloudWidth = 0;
+    int cloudHeight = 0;
+};
+
+inline void swap(OrganizedPointCloud& a, OrganizedPointCloud& b) noexcept { a.swap(b); }
+
+#endif // ORGANIZEDPOINTCLOUD_H
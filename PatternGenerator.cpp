@@ -0,0 +1,219 @@
+#include "PatternGenerator.h"
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "Trace.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+    const char cacheMagic[4] = {'K', 'P', 'A', 'T'};
+    const uint32_t cacheVersion = 1;
+
+    struct CacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t width;
+        uint32_t fringeRows;
+        uint32_t codeRows;
+        uint32_t reserved;
+        double fringes;
+        double phaseShiftDegrees;
+    };
+    static_assert(sizeof(CacheHeader) == 40, "pattern cache header must stay 40 bytes");
+
+    std::string joinPath(const std::string& directory, const std::string& name)
+    {
+        if (directory.empty() || directory.back() == '/' || directory.back() == '\\') return directory + name;
+        return directory + "/" + name;
+    }
+}
+
+PatternGenerator::PatternGenerator(int width, int height, double fringes, double phaseShiftDegrees)
+        : width(width), height(height), fringes(fringes), phaseShiftDegrees(phaseShiftDegrees),
+          codeBits(grayCodeBits(fringes))
+{
+
+}
+
+int PatternGenerator::grayCodeBits(double fringes)
+{
+    int bits = 1;
+    while (bits < 30 && std::ldexp(1.0, bits) < fringes) ++bits;
+    return bits;
+}
+
+void PatternGenerator::setCacheDirectory(const std::string& directory)
+{
+    cacheDirectory = directory;
+    rows.clear();
+}
+
+std::string PatternGenerator::cacheName() const
+{
+    std::ostringstream name;
+    name.precision(17);
+    name << "patterns_w" << width << "_f" << fringes << "_s" << phaseShiftDegrees << "_b" << codeBits << ".kpat";
+    return name.str();
+}
+
+void PatternGenerator::prepareRows()
+{
+    if (!rows.empty()) return;
+    if (!cacheDirectory.empty()) {
+        const std::string filename = joinPath(cacheDirectory, cacheName());
+        if (readCache(filename)) return;
+        computeRows();
+        //a failed write only costs the next run the computation
+        if (!writeCache(filename)) std::cerr << "Unable to write pattern cache: " << filename << std::endl;
+        return;
+    }
+    computeRows();
+}
+
+void PatternGenerator::computeRows()
+{
+    KIVI_TRACE_SCOPE("PatternGenerator::computeRows");
+    rows.assign(static_cast<size_t>(fringeCount + codeBits) * width, 0);
+    const double wavelength = width / fringes;
+    for (int k = 0; k < fringeCount; ++k) {
+        unsigned char* row = rows.data() + static_cast<size_t>(k) * width;
+        for (int x = 0; x < width; ++x) {
+            //convert [-1,1] to [0,1] for proper image
+            double value = 0.5*(1 + cos(2 * CV_PI * x / wavelength +k * CV_PI * phaseShiftDegrees/180.0));
+            row[x] = static_cast<unsigned char>(value *255);
+        }
+    }
+    const int orders = 1 << codeBits;
+    for (int x = 0; x < width; ++x) {
+        //the 0.4 offset and the reversed order reproduce the stripe edges of the captured gray_pattern_*.png images
+        const int stripe = static_cast<int>(std::floor((x + 0.5) / wavelength + 0.4));
+        const int order = ((orders - 1 - stripe) % orders + orders) % orders;
+        const int gray = order ^ (order >> 1);
+        for (int k = 0; k < codeBits; ++k) {
+            rows[static_cast<size_t>(fringeCount + k) * width + x] = (gray >> (codeBits - 1 - k)) & 1 ? 255 : 0;
+        }
+    }
+}
+
+bool PatternGenerator::readCache(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) return false;
+    CacheHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+    //a file of other parameters under the same name is recomputed and replaced
+    if (std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != cacheVersion
+        || header.width != static_cast<uint32_t>(width) || header.fringeRows != fringeCount
+        || header.codeRows != static_cast<uint32_t>(codeBits) || header.fringes != fringes
+        || header.phaseShiftDegrees != phaseShiftDegrees) {
+        return false;
+    }
+    rows.resize(static_cast<size_t>(fringeCount + codeBits) * width);
+    if (!in.read(reinterpret_cast<char*>(rows.data()), static_cast<std::streamsize>(rows.size()))) {
+        rows.clear();
+        return false;
+    }
+    return true;
+}
+
+bool PatternGenerator::writeCache(const std::string& filename) const
+{
+    CacheHeader header = {};
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.width = static_cast<uint32_t>(width);
+    header.fringeRows = fringeCount;
+    header.codeRows = static_cast<uint32_t>(codeBits);
+    header.fringes = fringes;
+    header.phaseShiftDegrees = phaseShiftDegrees;
+    //written next to the target under a name of this process and writer, then renamed over it,
+    //so concurrent runs never share a temporary file and readers see the old or the new cache
+    static std::atomic<unsigned> writes{0};
+#ifdef _WIN32
+    const unsigned long process = GetCurrentProcessId();
+#else
+    const unsigned long process = static_cast<unsigned long>(getpid());
+#endif
+    const std::string temporary = filename + "." + std::to_string(process) + "." + std::to_string(writes++) + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        if (!out.is_open()) return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(rows.data()), static_cast<std::streamsize>(rows.size()));
+        if (!out) {
+            out.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+#ifdef _WIN32
+    //rename does not replace an existing file on Windows
+    const bool renamed = MoveFileExA(temporary.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    const bool renamed = std::rename(temporary.c_str(), filename.c_str()) == 0;
+#endif
+    if (!renamed) std::remove(temporary.c_str());
+    return renamed;
+}
+
+void PatternGenerator::broadcast(const unsigned char* row, cv::Mat& image) const
+{
+    image.create(height, width, CV_8UC1);
+    for (int y = 0; y < height; ++y) {
+        std::memcpy(image.ptr<unsigned char>(y), row, width);
+    }
+}
+
+void PatternGenerator::fringePatterns(std::vector<cv::Mat>& patterns)
+{
+    KIVI_TRACE_SCOPE("PatternGenerator::fringePatterns");
+    prepareRows();
+    patterns.resize(fringeCount);
+    for (int k = 0; k < fringeCount; ++k) {
+        broadcast(rows.data() + static_cast<size_t>(k) * width, patterns[k]);
+    }
+}
+
+void PatternGenerator::grayCodePatterns(std::vector<cv::Mat>& patterns)
+{
+    KIVI_TRACE_SCOPE("PatternGenerator::grayCodePatterns");
+    prepareRows();
+    patterns.resize(codeBits);
+    for (int k = 0; k < codeBits; ++k) {
+        broadcast(rows.data() + static_cast<size_t>(fringeCount + k) * width, patterns[k]);
+    }
+}
+
+bool PatternGenerator::writeSequence(const std::string& directory)
+{
+    std::vector<cv::Mat> fringeImages, codeImages;
+    fringePatterns(fringeImages);
+    grayCodePatterns(codeImages);
+    bool ok = true;
+    for (size_t k = 0; k < fringeImages.size(); ++k) {
+        const std::string filePath = joinPath(directory, "fringe_pattern_" + std::to_string(k) + ".png");
+        if (!cv::imwrite(filePath, fringeImages[k])) {
+            std::cerr << "Error writing file: " << filePath << std::endl;
+            ok = false;
+        }
+    }
+    for (size_t k = 0; k < codeImages.size(); ++k) {
+        const std::string filePath = joinPath(directory, "gray_pattern_" + std::to_string(k) + ".png");
+        if (!cv::imwrite(filePath, codeImages[k])) {
+            std::cerr << "Error writing file: " << filePath << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
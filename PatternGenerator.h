@@ -0,0 +1,56 @@
+#ifndef PATTERNGENERATOR_H
+#define PATTERNGENERATOR_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+//Projector sequence of the double three-step method: six fringe images followed by the Gray-code images.
+//Every pattern varies along x only, so one row per pattern is computed and copied to every row. The rows
+//depend on the width, the fringe count and the phase step, not on the height, so the cache holds the rows
+//and one cache file serves every height.
+//Fringe image k is 255 * 0.5 * (1 + cos(2 pi x / wavelength + k * step)), truncated to 8 bits.
+//The Gray code has ceil(log2(fringes)) bits, most significant image first, 255 for a set bit. Stripe s
+//starts where (x + 0.5) / wavelength + 0.4 reaches s, its fringe order is (2^bits - 1 - s) mod 2^bits.
+//This is the layout of the shipped Gray-code captures, so generated and captured codes decode alike.
+class PatternGenerator {
+public:
+    PatternGenerator(int width, int height, double fringes, double phaseShiftDegrees);
+
+    //Gray-code images needed to number the fringes
+    static int grayCodeBits(double fringes);
+    int grayCodeCount() const { return codeBits; }
+
+    //reads the rows from <directory>/<cacheName()> when they were cached, writes them there otherwise,
+    //an empty directory keeps everything in memory
+    void setCacheDirectory(const std::string& directory);
+    //file name that encodes every parameter the rows depend on
+    std::string cacheName() const;
+
+    //six CV_8UC1 fringe images, phase steps 0 to 5, images of the right size are overwritten in place
+    void fringePatterns(std::vector<cv::Mat>& patterns);
+    //grayCodeCount() CV_8UC1 images, most significant bit first
+    void grayCodePatterns(std::vector<cv::Mat>& patterns);
+    //writes fringe_pattern_<k>.png and gray_pattern_<k>.png for the projector
+    bool writeSequence(const std::string& directory);
+
+private:
+    static constexpr int fringeCount = 6;
+    //fills rows from the cache or computes them
+    void prepareRows();
+    void computeRows();
+    bool readCache(const std::string& filename);
+    bool writeCache(const std::string& filename) const;
+    //copies row to every row of a width x height image
+    void broadcast(const unsigned char* row, cv::Mat& image) const;
+
+    int width, height;
+    double fringes;
+    double phaseShiftDegrees;
+    int codeBits;
+    std::string cacheDirectory;
+    //fringeCount fringe rows followed by codeBits Gray-code rows, width bytes each
+    std::vector<unsigned char> rows;
+};
+
+#endif // PATTERNGENERATOR_H
@@ -0,0 +1,203 @@
+#include "PhaseKernels.h"
+#include <cmath>
+#include <cstdint>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define KIVI_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace {
+    //the factor of a kernel in double, which Equation 7 has always been evaluated in
+    template<StepKernel Kernel>
+    double kernelFactor()
+    {
+        static_assert(Kernel != StepKernel::Runtime, "runtime factors take the generic loops");
+        return Kernel == StepKernel::Sqrt3 ? std::sqrt(3) : 1 / std::sqrt(3);
+    }
+
+    template<StepKernel Kernel>
+    void wrappedPhaseScalar(const unsigned char* i1, const unsigned char* i2, const unsigned char* i3, float* phase, int begin, int end)
+    {
+        const double factor = kernelFactor<Kernel>();
+        for (int x = begin; x < end; ++x) {
+            float a = i1[x], b = i2[x], c = i3[x];
+            phase[x] = std::atan2(factor * (a - c), 2 * b - a - c);//Equation 7 for Sqrt3
+        }
+    }
+
+    template<StepKernel Kernel>
+    void modulationScalar(const unsigned char* i1, const unsigned char* i2, const unsigned char* i3, float* modulation,
+                          float numeratorScale, float denominatorScale, int begin, int end)
+    {
+        const float factor = static_cast<float>(kernelFactor<Kernel>());
+        for (int x = begin; x < end; ++x) {
+            float a = i1[x], b = i2[x], c = i3[x];
+            modulation[x] = std::hypot(factor * (a - c) * numeratorScale, (2 * b - a - c) * denominatorScale);
+        }
+    }
+
+    void decodeGrayScalar(const unsigned char* const* codes, int bits, int* orders, int begin, int end)
+    {
+        for (int x = begin; x < end; ++x) {
+            //binary bit k is the XOR of the Gray bits up to k
+            int bit = 0, order = 0;
+            for (int k = 0; k < bits; ++k) {
+                bit ^= codes[k][x] > 0;
+                order = (order << 1) | bit;
+            }
+            orders[x] = order;
+        }
+    }
+}
+
+PhaseKernels::PhaseKernels(bool vectorized)
+        : useAvx2(false)
+{
+#ifdef KIVI_X86_SIMD
+    useAvx2 = vectorized && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    (void)vectorized;
+#endif
+}
+
+template<StepKernel Kernel>
+void PhaseKernels::wrappedPhase(const unsigned char* i1, const unsigned char* i2, const unsigned char* i3, float* phase, int count,
+                                float* modulation, float numeratorScale, float denominatorScale) const
+{
+    if (useAvx2) {
+        wrappedPhaseAvx2<Kernel>(i1, i2, i3, phase, count, modulation, numeratorScale, denominatorScale);
+        return;
+    }
+    wrappedPhaseScalar<Kernel>(i1, i2, i3, phase, 0, count);
+    if (modulation) modulationScalar<Kernel>(i1, i2, i3, modulation, numeratorScale, denominatorScale, 0, count);
+}
+
+template void PhaseKernels::wrappedPhase<StepKernel::Sqrt3>(const unsigned char*, const unsigned char*, const unsigned char*, float*, int,
+                                                            float*, float, float) const;
+template void PhaseKernels::wrappedPhase<StepKernel::InverseSqrt3>(const unsigned char*, const unsigned char*, const unsigned char*, float*, int,
+                                                                   float*, float, float) const;
+
+void PhaseKernels::decodeGray(const unsigned char* const* codes, int bits, int* orders, int count) const
+{
+    //orders are ints and the bit planes of the vector path hold 32 images
+    CV_Assert(bits > 0 && bits <= maxGrayBits);
+    if (useAvx2) {
+        decodeGrayAvx2(codes, bits, orders, count);
+        return;
+    }
+    decodeGrayScalar(codes, bits, orders, 0, count);
+}
+
+#ifdef KIVI_X86_SIMD
+
+namespace {
+    __attribute__((target("avx2,fma")))
+    inline __m256 loadBytesAsFloat(const unsigned char* p)
+    {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+    }
+
+    //atan2 with octant reduction and the degree 15 odd polynomial of Abramowitz & Stegun 4.4.49
+    __attribute__((target("avx2,fma")))
+    inline __m256 atan2Avx2(__m256 y, __m256 x)
+    {
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+        __m256 ay = _mm256_andnot_ps(signMask, y);
+        __m256 ax = _mm256_andnot_ps(signMask, x);
+        __m256 swap = _mm256_cmp_ps(ay, ax, _CMP_GT_OQ);
+        __m256 numerator = _mm256_min_ps(ay, ax);
+        __m256 denominator = _mm256_max_ps(ay, ax);
+        //atan2(0, 0) is 0, avoid 0/0
+        __m256 zero = _mm256_cmp_ps(denominator, _mm256_setzero_ps(), _CMP_EQ_OQ);
+        __m256 z = _mm256_andnot_ps(zero, _mm256_div_ps(numerator, denominator));
+        __m256 z2 = _mm256_mul_ps(z, z);
+        __m256 p = _mm256_set1_ps(-0.0040540580f);
+        p = _mm256_fmadd_ps(p, z2, _mm256_set1_ps(0.0218612288f));
+        p = _mm256_fmadd_ps(p, z2, _mm256_set1_ps(-0.0559098861f));
+        p = _mm256_fmadd_ps(p, z2, _mm256_set1_ps(0.0964200441f));
+        p = _mm256_fmadd_ps(p, z2, _mm256_set1_ps(-0.1390853351f));
+        p = _mm256_fmadd_ps(p, z2, _mm256_set1_ps(0.1994653599f));
+        p = _mm256_fmadd_ps(p, z2, _mm256_set1_ps(-0.3332985605f));
+        p = _mm256_fmadd_ps(p, z2, _mm256_set1_ps(0.9999993329f));
+        __m256 r = _mm256_mul_ps(p, z);
+        r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(static_cast<float>(M_PI_2)), r), swap);
+        r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(static_cast<float>(M_PI)), r), x);//x < 0, sign bit set
+        return _mm256_or_ps(r, _mm256_and_ps(y, signMask));
+    }
+}
+
+template<StepKernel Kernel>
+__attribute__((target("avx2,fma")))
+void PhaseKernels::wrappedPhaseAvx2(const unsigned char* i1, const unsigned char* i2, const unsigned char* i3, float* phase, int count,
+                                    float* modulation, float numeratorScale, float denominatorScale) const
+{
+    const __m256 factor = _mm256_set1_ps(static_cast<float>(kernelFactor<Kernel>()));
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 numeratorScaleV = _mm256_set1_ps(numeratorScale);
+    const __m256 denominatorScaleV = _mm256_set1_ps(denominatorScale);
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256 a = loadBytesAsFloat(i1 + x);
+        __m256 b = loadBytesAsFloat(i2 + x);
+        __m256 c = loadBytesAsFloat(i3 + x);
+        __m256 y = _mm256_mul_ps(factor, _mm256_sub_ps(a, c));
+        __m256 d = _mm256_sub_ps(_mm256_fmsub_ps(two, b, a), c);
+        _mm256_storeu_ps(phase + x, atan2Avx2(y, d));
+        if (modulation) {
+            //numerator and denominator are already in registers, the modulation costs one sqrt
+            __m256 sine = _mm256_mul_ps(y, numeratorScaleV);
+            __m256 cosine = _mm256_mul_ps(d, denominatorScaleV);
+            _mm256_storeu_ps(modulation + x, _mm256_sqrt_ps(_mm256_fmadd_ps(sine, sine, _mm256_mul_ps(cosine, cosine))));
+        }
+    }
+    wrappedPhaseScalar<Kernel>(i1, i2, i3, phase, x, count);
+    if (modulation) modulationScalar<Kernel>(i1, i2, i3, modulation, numeratorScale, denominatorScale, x, count);
+}
+
+__attribute__((target("avx2,fma")))
+void PhaseKernels::decodeGrayAvx2(const unsigned char* const* codes, int bits, int* orders, int count) const
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    uint32_t planes[32];
+    int x = 0;
+    for (; x + 32 <= count; x += 32) {
+        //one bit per pixel and Gray image, converted to binary planes by a running XOR
+        uint32_t prefix = 0;
+        for (int k = 0; k < bits; ++k) {
+            __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes[k] + x));
+            uint32_t dark = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(pixels, zero)));
+            prefix ^= ~dark;
+            planes[k] = prefix;
+        }
+        //expand the planes into eight 32-bit orders at a time
+        for (int group = 0; group < 4; ++group) {
+            __m256i order = zero;
+            for (int k = 0; k < bits; ++k) {
+                __m256i bitsOfGroup = _mm256_set1_epi32(static_cast<int>((planes[k] >> (8 * group)) & 0xFF));
+                __m256i set = _mm256_cmpeq_epi32(_mm256_and_si256(bitsOfGroup, laneBits), laneBits);
+                order = _mm256_or_si256(order, _mm256_and_si256(set, _mm256_set1_epi32(1 << (bits - 1 - k))));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(orders + x + 8 * group), order);
+        }
+    }
+    decodeGrayScalar(codes, bits, orders, x, count);
+}
+
+#else
+
+template<StepKernel Kernel>
+void PhaseKernels::wrappedPhaseAvx2(const unsigned char* i1, const unsigned char* i2, const unsigned char* i3, float* phase, int count,
+                                    float* modulation, float numeratorScale, float denominatorScale) const
+{
+    wrappedPhaseScalar<Kernel>(i1, i2, i3, phase, 0, count);
+    if (modulation) modulationScalar<Kernel>(i1, i2, i3, modulation, numeratorScale, denominatorScale, 0, count);
+}
+
+void PhaseKernels::decodeGrayAvx2(const unsigned char* const* codes, int bits, int* orders, int count) const
+{
+    decodeGrayScalar(codes, bits, orders, 0, count);
+}
+
+#endif
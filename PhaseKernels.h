@@ -0,0 +1,95 @@
+#ifndef PHASEKERNELS_H
+#define PHASEKERNELS_H
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <type_traits>
+
+//Row kernels for 8-bit fringe and Gray-code images.
+//wrappedPhase evaluates Equation 7 or its 60 degree counterpart. The scalar path calls atan2 exactly as
+//before, the AVX2 path uses a polynomial atan2 (Abramowitz & Stegun 4.4.49 after octant reduction). Over all
+//2^24 input triples the polynomial differs from the scalar path by at most 2.4e-7 rad, for either factor.
+//decodeGray is exact on both paths. The AVX2 path is bit-sliced: the thresholds of 32 pixels are packed
+//into one mask per Gray image, the Gray to binary conversion is a prefix XOR over those masks and the
+//result planes are expanded back into per pixel fringe orders.
+//wrappedPhaseRow and decodeGrayRow take any camera depth (unsigned char for 8-bit, unsigned short for 10, 12 and
+//16-bit data) and accumulator. A StepKernel other than Runtime compiles its factor in, 8-bit rows with a float
+//accumulator then take the kernels above, everything else runs the generic loops below.
+//With a modulation row the same pass also writes the fringe modulation B of I = A + B cos(phase), which is
+//hypot(numerator * numeratorScale, denominator * denominatorScale). For a step d the numerator f (i1 - i3) is
+//2 f B sin d sin(phase) and the denominator 2 B (1 - cos d) cos(phase), so the scales are 1 / (2 f sin d) and
+//1 / (2 (1 - cos d)), both 1/3 for Equation 7 on a 120 degree step.
+
+//Factor in front of (i1 - i3) that a kernel compiles in. Sqrt3 is Equation 7, the 120 degree form, InverseSqrt3
+//is (1 - cos d) / sin d of the 60 degree step the generated patterns use, Runtime takes the factor as an argument.
+enum class StepKernel { Sqrt3, InverseSqrt3, Runtime };
+
+class PhaseKernels {
+public:
+    explicit PhaseKernels(bool vectorized = true);
+    bool isVectorized() const { return useAvx2; }
+
+    //phase[x] = atan2(f * (i1 - i3), 2 * i2 - i1 - i3) with the factor f of Kernel, which is not Runtime.
+    //modulation is skipped when null.
+    template<StepKernel Kernel>
+    void wrappedPhase(const unsigned char* i1, const unsigned char* i2, const unsigned char* i3, float* phase, int count,
+                      float* modulation = nullptr, float numeratorScale = 1.0f / 3.0f, float denominatorScale = 1.0f / 3.0f) const;
+    //Gray images one decode takes, the orders are ints
+    static const int maxGrayBits = 31;
+    //codes[k] is the row of Gray image k, most significant bit first, a pixel is set when it is above 0.
+    //bits is 1 to maxGrayBits.
+    void decodeGray(const unsigned char* const* codes, int bits, int* orders, int count) const;
+
+    //phase[x] = atan2(stepFactor * (i1 - i3), 2 * i2 - i1 - i3), stepFactor is only read by the Runtime kernel
+    template<StepKernel Kernel, typename Pixel, typename Accumulator>
+    void wrappedPhaseRow(const Pixel* i1, const Pixel* i2, const Pixel* i3, Accumulator* phase, int count, Accumulator stepFactor,
+                         Accumulator* modulation = nullptr, Accumulator numeratorScale = Accumulator(1) / 3,
+                         Accumulator denominatorScale = Accumulator(1) / 3) const
+    {
+        if constexpr (Kernel != StepKernel::Runtime && std::is_same<Pixel, unsigned char>::value && std::is_same<Accumulator, float>::value) {
+            wrappedPhase<Kernel>(i1, i2, i3, phase, count, modulation, numeratorScale, denominatorScale);
+        }
+        else {
+            const Accumulator factor = Kernel == StepKernel::Sqrt3 ? static_cast<Accumulator>(1.7320508075688772)
+                                       : Kernel == StepKernel::InverseSqrt3 ? static_cast<Accumulator>(0.57735026918962576) : stepFactor;
+            for (int x = 0; x < count; ++x) {
+                Accumulator a = i1[x], b = i2[x], c = i3[x];
+                phase[x] = std::atan2(factor * (a - c), 2 * b - a - c);
+            }
+            if (!modulation) return;
+            for (int x = 0; x < count; ++x) {
+                Accumulator a = i1[x], b = i2[x], c = i3[x];
+                modulation[x] = std::hypot(factor * (a - c) * numeratorScale, (2 * b - a - c) * denominatorScale);
+            }
+        }
+    }
+
+    template<typename Pixel>
+    void decodeGrayRow(const Pixel* const* codes, int bits, int* orders, int count) const
+    {
+        if constexpr (std::is_same<Pixel, unsigned char>::value) {
+            decodeGray(codes, bits, orders, count);
+        }
+        else {
+            CV_Assert(bits > 0 && bits <= maxGrayBits);
+            for (int x = 0; x < count; ++x) {
+                int bit = 0, order = 0;
+                for (int k = 0; k < bits; ++k) {
+                    bit ^= codes[k][x] > 0;
+                    order = (order << 1) | bit;
+                }
+                orders[x] = order;
+            }
+        }
+    }
+
+private:
+    template<StepKernel Kernel>
+    void wrappedPhaseAvx2(const unsigned char* i1, const unsigned char* i2, const unsigned char* i3, float* phase, int count,
+                          float* modulation, float numeratorScale, float denominatorScale) const;
+    void decodeGrayAvx2(const unsigned char* const* codes, int bits, int* orders, int count) const;
+
+    bool useAvx2;
+};
+
+#endif // PHASEKERNELS_H
@@ -0,0 +1,211 @@
+#include "PhaseMapIO.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "Trace.h"
+
+namespace {
+    const char phaseMapMagic[4] = {'K', 'P', 'H', 'M'};
+    const uint32_t phaseMapVersion = 1;
+    const uint32_t hasMaskFlag = 1;
+    const size_t phaseMapAlignment = 64;
+
+    struct PhaseMapHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t rows;
+        uint32_t cols;
+        uint32_t dataType;
+        uint32_t flags;
+        uint64_t payloadOffset;
+        uint64_t maskOffset;
+        char reserved[24];
+    };
+    static_assert(sizeof(PhaseMapHeader) == 64, "phase map header must stay 64 bytes");
+
+    size_t alignUp(size_t value)
+    {
+        return (value + phaseMapAlignment - 1) & ~(phaseMapAlignment - 1);
+    }
+
+    bool writePadding(std::ofstream& out, size_t from, size_t to)
+    {
+        static const char zeros[phaseMapAlignment] = {};
+        out.write(zeros, static_cast<std::streamsize>(to - from));
+        return static_cast<bool>(out);
+    }
+
+    bool writeRows(std::ofstream& out, const cv::Mat& mat)
+    {
+        const std::streamsize rowBytes = static_cast<std::streamsize>(mat.cols * mat.elemSize());
+        if (mat.isContinuous()) {
+            out.write(reinterpret_cast<const char*>(mat.data), rowBytes * mat.rows);
+        }
+        else {
+            for (int y = 0; y < mat.rows; ++y) out.write(mat.ptr<char>(y), rowBytes);
+        }
+        return static_cast<bool>(out);
+    }
+
+    const char* skipBlanks(const char* p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        return p;
+    }
+}
+
+bool PhaseMapFile::write(const std::string& filename, const cv::Mat& phaseMap, const cv::Mat& mask)
+{
+    KIVI_TRACE_SCOPE("PhaseMapFile::write");
+    if (phaseMap.empty() || (phaseMap.type() != CV_32FC1 && phaseMap.type() != CV_64FC1)) {
+        std::cerr << "Phase map must be a single channel float or double image: " << filename << std::endl;
+        return false;
+    }
+    if (!mask.empty() && (mask.type() != CV_8UC1 || mask.size() != phaseMap.size())) {
+        std::cerr << "Phase map mask must be 8-bit and match the map size: " << filename << std::endl;
+        return false;
+    }
+    const size_t payloadBytes = phaseMap.total() * phaseMap.elemSize();
+    PhaseMapHeader header = {};
+    std::memcpy(header.magic, phaseMapMagic, sizeof(phaseMapMagic));
+    header.version = phaseMapVersion;
+    header.rows = static_cast<uint32_t>(phaseMap.rows);
+    header.cols = static_cast<uint32_t>(phaseMap.cols);
+    header.dataType = phaseMap.type() == CV_32FC1 ? Float32 : Float64;
+    header.flags = mask.empty() ? 0 : hasMaskFlag;
+    header.payloadOffset = alignUp(sizeof(PhaseMapHeader));
+    header.maskOffset = mask.empty() ? 0 : alignUp(header.payloadOffset + payloadBytes);
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return false;
+    }
+    bool ok = static_cast<bool>(out.write(reinterpret_cast<const char*>(&header), sizeof(header)));
+    ok = ok && writePadding(out, sizeof(header), header.payloadOffset);
+    ok = ok && writeRows(out, phaseMap);
+    if (ok && !mask.empty()) {
+        ok = writePadding(out, header.payloadOffset + payloadBytes, header.maskOffset) && writeRows(out, mask);
+    }
+    if (!ok) std::cerr << "Error writing file: " << filename << std::endl;
+    return ok;
+}
+
+bool PhaseMapFile::open(const std::string& filename)
+{
+    KIVI_TRACE_SCOPE("PhaseMapFile::open");
+    close();
+    if (!file.open(filename)) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return false;
+    }
+    PhaseMapHeader header;
+    if (file.size() < sizeof(header)) {
+        std::cerr << "Not a phase map file: " << filename << std::endl;
+        close();
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, phaseMapMagic, sizeof(phaseMapMagic)) != 0 || header.version != phaseMapVersion
+        || header.dataType > Float64 || header.rows == 0 || header.cols == 0) {
+        std::cerr << "Not a phase map file: " << filename << std::endl;
+        close();
+        return false;
+    }
+    const int type = header.dataType == Float32 ? CV_32FC1 : CV_64FC1;
+    const size_t pixels = static_cast<size_t>(header.rows) * header.cols;
+    const size_t payloadBytes = pixels * (header.dataType == Float32 ? sizeof(float) : sizeof(double));
+    const bool hasMask = (header.flags & hasMaskFlag) != 0;
+    if (header.payloadOffset % phaseMapAlignment != 0 || header.payloadOffset + payloadBytes > file.size()
+        || (hasMask && header.maskOffset + pixels > file.size())) {
+        std::cerr << "Truncated phase map file: " << filename << std::endl;
+        close();
+        return false;
+    }
+    //the Mat headers point into the mapping, nothing is copied
+    char* base = const_cast<char*>(file.data());
+    phaseHeader = cv::Mat(static_cast<int>(header.rows), static_cast<int>(header.cols), type, base + header.payloadOffset);
+    if (hasMask) {
+        maskHeader = cv::Mat(static_cast<int>(header.rows), static_cast<int>(header.cols), CV_8UC1, base + header.maskOffset);
+    }
+    return true;
+}
+
+void PhaseMapFile::close()
+{
+    phaseHeader.release();
+    maskHeader.release();
+    file.close();
+}
+
+cv::Mat readCsvPhaseMap(const std::string& filename)
+{
+    KIVI_TRACE_SCOPE("readCsvPhaseMap");
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return cv::Mat();
+    }
+    const char* begin = file.data();
+    const char* end = begin + file.size();
+    //one pass over the bytes to find the line starts, the lines are then parsed independently
+    std::vector<const char*> lines;
+    for (const char* p = begin; p < end;) {
+        const char* next = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+        const char* lineEnd = next ? next : end;
+        if (lineEnd > p && !(lineEnd - p == 1 && *p == '\r')) lines.push_back(p);
+        p = next ? next + 1 : end;
+    }
+    if (lines.empty()) {
+        std::cerr << "Empty phase map: " << filename << std::endl;
+        return cv::Mat();
+    }
+    const char* firstEnd = static_cast<const char*>(std::memchr(lines[0], '\n', static_cast<size_t>(end - lines[0])));
+    const int cols = static_cast<int>(std::count(lines[0], firstEnd ? firstEnd : end, ',')) + 1;
+    cv::Mat phaseMap(static_cast<int>(lines.size()), cols, CV_64F);
+
+    std::atomic<int> badRow{-1};
+    cv::parallel_for_(cv::Range(0, phaseMap.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            double* row = phaseMap.ptr<double>(y);
+            const char* p = lines[y];
+            bool ok = true;
+            for (int x = 0; x < cols && ok; ++x) {
+                auto result = std::from_chars(skipBlanks(p, end), end, row[x]);
+                p = skipBlanks(result.ptr, end);
+                ok = result.ec == std::errc();
+                //values are separated by commas, the last one is followed by the line end
+                if (x + 1 < cols) ok = ok && p < end && *p++ == ',';
+                else ok = ok && (p == end || *p == '\r' || *p == '\n');
+            }
+            if (!ok) {
+                badRow = y;
+                return;
+            }
+        }
+    });
+    if (badRow >= 0) {
+        std::cerr << "Malformed phase map row " << badRow << ": " << filename << std::endl;
+        return cv::Mat();
+    }
+    return phaseMap;
+}
+
+bool convertCsvToPhaseMap(const std::string& csvFilename, const std::string& phaseMapFilename, bool float32)
+{
+    cv::Mat phaseMap = readCsvPhaseMap(csvFilename);
+    if (phaseMap.empty()) return false;
+    if (float32) phaseMap.convertTo(phaseMap, CV_32F);
+    return PhaseMapFile::write(phaseMapFilename, phaseMap);
+}
+
+bool isPhaseMapFile(const std::string& filename)
+{
+    const std::string extension = ".kphm";
+    return filename.size() >= extension.size()
+           && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
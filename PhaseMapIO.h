@@ -0,0 +1,40 @@
+#ifndef PHASEMAPIO_H
+#define PHASEMAPIO_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include "MappedFile.h"
+
+//Binary phase map file (.kphm).
+//A 64 byte little endian header (magic "KPHM", version, rows, cols, dtype, flags, payload and mask offsets)
+//is followed by the row-major float32 or float64 payload and an optional 8-bit validity mask, both 64-byte aligned.
+class PhaseMapFile {
+public:
+    enum DataType : uint32_t { Float32 = 0, Float64 = 1 };
+
+    //phaseMap must be CV_32FC1 or CV_64FC1, mask is optional CV_8UC1 with non-zero for valid pixels
+    static bool write(const std::string& filename, const cv::Mat& phaseMap, const cv::Mat& mask = cv::Mat());
+
+    //maps the file, phase() and mask() are headers over the mapping and stay valid until close
+    bool open(const std::string& filename);
+    void close();
+    //read only, the mapping is not writable
+    const cv::Mat& phase() const { return phaseHeader; }
+    //empty when the file has no mask
+    const cv::Mat& mask() const { return maskHeader; }
+
+private:
+    MappedFile file;
+    cv::Mat phaseHeader;
+    cv::Mat maskHeader;
+};
+
+//Parses a comma separated phase map into a CV_64F Mat, rows are parsed in parallel with std::from_chars.
+cv::Mat readCsvPhaseMap(const std::string& filename);
+//Converts a legacy CSV phase map to the binary format, float32 halves the size of full resolution maps
+bool convertCsvToPhaseMap(const std::string& csvFilename, const std::string& phaseMapFilename, bool float32 = false);
+//true for names ending in .kphm
+bool isPhaseMapFile(const std::string& filename);
+
+#endif // PHASEMAPIO_H
@@ -0,0 +1,114 @@
+#include "PhaseMatcher.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include "Trace.h"
+
+PhaseMatcher::PhaseMatcher(float minDisparity, float maxDisparity, int maxGap)
+        : minDisparity(minDisparity), maxDisparity(maxDisparity), maxGap(std::max(1, maxGap)) {}
+
+template<typename T>
+void PhaseMatcher::matchRow(const T* left, const T* right, int cols, double* phases, float* positions, float* disparity) const
+{
+    const float noMatch = std::numeric_limits<float>::quiet_NaN();
+    //the fringe order may run either way across the image, the index is always built increasing
+    int first = 0, last = cols - 1;
+    while (first < cols && !std::isfinite(static_cast<double>(right[first]))) ++first;
+    while (last > first && !std::isfinite(static_cast<double>(right[last]))) --last;
+    const double sign = first < last && right[last] < right[first] ? -1.0 : 1.0;
+
+    size_t samples = 0;
+    int belowStart = -1;//first pixel since the last index entry that did not rise above the index
+    for (int x = first; x <= last; ++x) {
+        const double value = sign * static_cast<double>(right[x]);
+        if (!std::isfinite(value)) continue;
+        if (samples == 0 || value > phases[samples - 1]) {
+            phases[samples] = value;
+            positions[samples] = static_cast<float>(x);
+            ++samples;
+            belowStart = -1;
+            continue;
+        }
+        if (belowStart < 0) belowStart = x;
+        if (x - belowStart < maxGap) continue;
+        //the row stayed below the index for more than maxGap pixels. When at most maxGap entries lie above the
+        //pixel where it fell back, they were a spike such as a wrong fringe order, so they are dropped and the
+        //index continues from that pixel. Longer runs above it are kept and the pixels below are skipped.
+        const double fallback = sign * static_cast<double>(right[belowStart]);
+        size_t kept = samples;
+        while (kept > 0 && samples - kept < static_cast<size_t>(maxGap) && phases[kept - 1] >= fallback) --kept;
+        if (kept == 0 || phases[kept - 1] < fallback) {
+            samples = kept;
+            x = belowStart - 1;
+        }
+        belowStart = -1;
+    }
+    if (samples < 2) {
+        std::fill(disparity, disparity + cols, noMatch);
+        return;
+    }
+
+    const size_t lastBracket = samples - 2;
+    size_t bracket = 0;
+    for (int x = 0; x < cols; ++x) {
+        const double value = sign * static_cast<double>(left[x]);
+        if (!(value >= phases[0] && value <= phases[samples - 1])) {//also catches NaN
+            disparity[x] = noMatch;
+            continue;
+        }
+        //phases[bracket] <= value <= phases[bracket + 1], usually the bracket of the previous pixel or the next one
+        if (!(phases[bracket] <= value && value <= phases[bracket + 1])) {
+            if (bracket < lastBracket && phases[bracket + 1] <= value && value <= phases[bracket + 2]) {
+                ++bracket;
+            }
+            else {
+                const size_t upper = std::upper_bound(phases, phases + samples, value) - phases;
+                bracket = std::min(upper == 0 ? 0 : upper - 1, lastBracket);
+            }
+        }
+        const float x0 = positions[bracket], x1 = positions[bracket + 1];
+        if (x1 - x0 > static_cast<float>(maxGap)) {
+            disparity[x] = noMatch;
+            continue;
+        }
+        const double t = (value - phases[bracket]) / (phases[bracket + 1] - phases[bracket]);
+        const float matched = x0 + static_cast<float>(t) * (x1 - x0);
+        const float d = static_cast<float>(x) - matched;
+        disparity[x] = d >= minDisparity && d <= maxDisparity ? d : noMatch;
+    }
+}
+
+void PhaseMatcher::match(const cv::Mat& left, const cv::Mat& right, cv::Mat& disparity, FrameArena* arena) const
+{
+    KIVI_TRACE_SCOPE("PhaseMatcher::match");
+    KIVI_TRACE_COUNT("disparity_pixels", static_cast<int64_t>(left.total()));
+    if (left.size() != right.size() || left.type() != right.type()
+        || (left.type() != CV_32FC1 && left.type() != CV_64FC1)) {
+        std::cerr << "Phase maps must be single channel float or double images of the same size" << std::endl;
+        disparity.release();
+        return;
+    }
+    disparity.create(left.rows, left.cols, CV_32FC1);
+    const bool isDouble = left.type() == CV_64FC1;
+    //without an arena of the caller the chunks share one that lives for this call
+    std::unique_ptr<FrameArena> callArena;
+    if (!arena) {
+        callArena = std::make_unique<FrameArena>();
+        arena = callArena.get();
+    }
+    parallelRows(cv::Range(0, left.rows), [&](const cv::Range& range) {
+        //index buffers are reused for all rows of the chunk
+        double* phases = arena->allocate<double>(left.cols);
+        float* positions = arena->allocate<float>(left.cols);
+        for (int y = range.start; y < range.end; ++y) {
+            if (isDouble) {
+                matchRow(left.ptr<double>(y), right.ptr<double>(y), left.cols, phases, positions, disparity.ptr<float>(y));
+            }
+            else {
+                matchRow(left.ptr<float>(y), right.ptr<float>(y), left.cols, phases, positions, disparity.ptr<float>(y));
+            }
+        }
+    });
+}
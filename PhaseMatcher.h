@@ -0,0 +1,33 @@
+#ifndef PHASEMATCHER_H
+#define PHASEMATCHER_H
+
+#include <opencv2/opencv.hpp>
+#include "FrameArena.h"
+
+//Phase based correspondence on rectified unwrapped phase maps.
+//Every right row is turned into a strictly monotonic phase index (samples that break the running maximum,
+//such as noise or NaN holes, are left out, and a run of at most maxGap samples above the rest of the row is
+//dropped from the index so a single spike does not hide the row behind it). Each left pixel is looked up in the index of the same row and the
+//right position is interpolated linearly between the two bracketing samples, which gives sub-pixel disparity.
+//The lookup first tries the bracket of the previous pixel, so smooth rows cost O(1) per pixel and the
+//binary search fallback keeps the worst case at O(log W). Rows are matched in parallel.
+class PhaseMatcher {
+public:
+    //disparity = xLeft - xRight, matches outside [minDisparity, maxDisparity] are rejected
+    PhaseMatcher(float minDisparity = 0.0f, float maxDisparity = 1e9f, int maxGap = 4);
+
+    //left and right are CV_32FC1 or CV_64FC1 of the same size, disparity becomes CV_32FC1 with NaN where no match was found.
+    //disparity keeps its buffer when the size stays, the row indices come from arena or, without one, from the heap.
+    void match(const cv::Mat& left, const cv::Mat& right, cv::Mat& disparity, FrameArena* arena = nullptr) const;
+
+private:
+    //phases and positions hold cols entries, the index of the right row
+    template<typename T>
+    void matchRow(const T* left, const T* right, int cols, double* phases, float* positions, float* disparity) const;
+
+    float minDisparity, maxDisparity;
+    //index samples further apart than this many pixels bracket a hole and give no match
+    int maxGap;
+};
+
+#endif // PHASEMATCHER_H
@@ -0,0 +1,172 @@
+#include "PhaseStreamPipeline.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace {
+    //spin briefly, then back off so an idle stage does not hold a core
+    void waitABit(int& spins)
+    {
+        if (++spins < 64) {
+            std::this_thread::yield();
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+}
+
+FileSequenceSource::FileSequenceSource(std::vector<std::string> paths, int repeat)
+        : paths(std::move(paths)), repeat(repeat) {}
+
+FileSequenceSource FileSequenceSource::fromPrefixes(const std::string& phasePrefix, const std::string& grayPrefix, int numGrayImages, int repeat)
+{
+    std::vector<std::string> paths;
+    for (int i = 0; i < 6; ++i) paths.push_back(phasePrefix + std::to_string(i) + ".png");
+    for (int i = 0; i < numGrayImages; ++i) paths.push_back(grayPrefix + std::to_string(i) + ".png");
+    return FileSequenceSource(paths, repeat);
+}
+
+bool FileSequenceSource::read(cv::Mat& frame)
+{
+    if (paths.empty() || next >= paths.size() * static_cast<size_t>(repeat)) return false;
+    const std::string& path = paths[next++ % paths.size()];
+    frame = cv::imread(path, cv::IMREAD_GRAYSCALE);
+    if (frame.empty()) {
+        std::cerr << "Error reading file: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+PhaseStreamPipeline::PhaseStreamPipeline(int width, int height, int numGrayImages, int poolSize)
+        : width(width), height(height), numGrayImages(numGrayImages), pool(std::max(2, poolSize)),
+          freeSlots(pool.size()), decodeQueue(pool.size()), resultQueue(pool.size()), decoder(width, height)
+{
+    //every buffer of the pipeline is allocated here, the stream itself only copies into them
+    for (size_t slot = 0; slot < pool.size(); ++slot) {
+        Sequence& sequence = pool[slot];
+        sequence.fringes.resize(6);
+        for (auto& frame : sequence.fringes) frame.create(height, width, CV_8UC1);
+        sequence.grayCodes.resize(numGrayImages);
+        for (auto& frame : sequence.grayCodes) frame.create(height, width, CV_8UC1);
+        sequence.unwrapped.create(height, width, CV_32FC1);
+        freeSlots.tryPush(static_cast<int>(slot));
+    }
+    decodeThread = std::thread(&PhaseStreamPipeline::decodeLoop, this);
+}
+
+PhaseStreamPipeline::~PhaseStreamPipeline()
+{
+    stop();
+    decodeThread.join();
+}
+
+void PhaseStreamPipeline::stop()
+{
+    stopping.store(true, std::memory_order_release);
+}
+
+bool PhaseStreamPipeline::pushFrame(const cv::Mat& frame)
+{
+    if (frame.type() != CV_8UC1 || frame.rows != height || frame.cols != width) {
+        std::cerr << "Frame rejected, expected " << width << "x" << height << " 8-bit gray" << std::endl;
+        return false;
+    }
+    if (inputFinished.load(std::memory_order_relaxed) || stopping.load(std::memory_order_acquire)) return false;
+    if (fillingSlot < 0) {
+        int spins = 0;
+        while (!freeSlots.tryPop(fillingSlot)) {
+            //a consumer that stopped never hands the slots back
+            if (stopping.load(std::memory_order_acquire)) return false;
+            waitABit(spins);
+        }
+        filledFrames = 0;
+    }
+    Sequence& sequence = pool[fillingSlot];
+    cv::Mat& target = filledFrames < 6 ? sequence.fringes[filledFrames] : sequence.grayCodes[filledFrames - 6];
+    frame.copyTo(target);
+    if (++filledFrames == framesPerSequence()) {
+        sequence.index = nextSequence++;
+        //cannot fail, the ring holds every slot
+        decodeQueue.tryPush(fillingSlot);
+        fillingSlot = -1;
+    }
+    return true;
+}
+
+void PhaseStreamPipeline::finish()
+{
+    filledFrames = 0;
+    inputFinished.store(true, std::memory_order_release);
+}
+
+void PhaseStreamPipeline::decodeLoop()
+{
+    auto decode = [&](int slot) {
+        Sequence& sequence = pool[slot];
+        decoder.computeUnwrappedPhaseFused(sequence.fringes, sequence.grayCodes, sequence.unwrapped);
+        resultQueue.tryPush(slot);
+    };
+    int spins = 0;
+    while (!stopping) {
+        int slot;
+        if (decodeQueue.tryPop(slot)) {
+            decode(slot);
+            spins = 0;
+            continue;
+        }
+        if (inputFinished.load(std::memory_order_acquire)) {
+            //the capture side queues its last sequence before it sets inputFinished, so look once more
+            if (!decodeQueue.tryPop(slot)) break;
+            decode(slot);
+            continue;
+        }
+        waitABit(spins);
+    }
+    decodeFinished.store(true, std::memory_order_release);
+}
+
+bool PhaseStreamPipeline::popResult(cv::Mat& unwrapped, uint64_t* sequenceIndex)
+{
+    int slot;
+    int spins = 0;
+    for (;;) {
+        if (stopping.load(std::memory_order_acquire)) return false;
+        if (resultQueue.tryPop(slot)) break;
+        if (decodeFinished.load(std::memory_order_acquire)) {
+            if (resultQueue.tryPop(slot)) break;
+            return false;
+        }
+        waitABit(spins);
+    }
+    const Sequence& sequence = pool[slot];
+    sequence.unwrapped.copyTo(unwrapped);
+    if (sequenceIndex) *sequenceIndex = sequence.index;
+    freeSlots.tryPush(slot);
+    return true;
+}
+
+size_t PhaseStreamPipeline::run(FrameSource& source, const std::function<bool(const cv::Mat&, uint64_t)>& onResult)
+{
+    std::thread capture([&] {
+        cv::Mat frame;
+        while (source.read(frame)) {
+            if (!pushFrame(frame)) break;
+        }
+        finish();
+    });
+    size_t sequences = 0;
+    cv::Mat unwrapped;
+    uint64_t index;
+    while (popResult(unwrapped, &index)) {
+        ++sequences;
+        if (!onResult(unwrapped, index)) {
+            //releases the capture thread if it waits for a slot
+            stop();
+            break;
+        }
+    }
+    capture.join();
+    return sequences;
+}
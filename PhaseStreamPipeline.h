@@ -0,0 +1,85 @@
+#ifndef PHASESTREAMPIPELINE_H
+#define PHASESTREAMPIPELINE_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DoubleThreeStepPhaseShifting.h"
+#include "SpscRingBuffer.h"
+
+//Source of captured 8-bit frames, stands in for the camera driver.
+class FrameSource {
+public:
+    virtual ~FrameSource() = default;
+    //false when no more frames follow
+    virtual bool read(cv::Mat& frame) = 0;
+};
+
+//Replays a list of image files in order, used in place of the camera for offline runs.
+class FileSequenceSource : public FrameSource {
+public:
+    explicit FileSequenceSource(std::vector<std::string> paths, int repeat = 1);
+    //<phasePrefix>0.png ... <phasePrefix>5.png followed by <grayPrefix>0.png ... <grayPrefix>N-1.png
+    static FileSequenceSource fromPrefixes(const std::string& phasePrefix, const std::string& grayPrefix, int numGrayImages, int repeat = 1);
+    bool read(cv::Mat& frame) override;
+
+private:
+    std::vector<std::string> paths;
+    int repeat;
+    size_t next = 0;
+};
+
+//Decodes a stream of captured sequences (6 phase frames followed by N Gray-code frames) into unwrapped phase maps.
+//Frames are copied into a preallocated pool of sequence slots. Full slots travel to the decode thread and back
+//through lock-free single producer rings, so decoding sequence k overlaps with the capture of sequence k + 1.
+//pushFrame and popResult may run on different threads, but each of them on one thread only.
+class PhaseStreamPipeline {
+public:
+    PhaseStreamPipeline(int width, int height, int numGrayImages, int poolSize = 3);
+    ~PhaseStreamPipeline();
+    PhaseStreamPipeline(const PhaseStreamPipeline&) = delete;
+    PhaseStreamPipeline& operator=(const PhaseStreamPipeline&) = delete;
+
+    int framesPerSequence() const { return 6 + numGrayImages; }
+    //copies the frame into the pool, waits while every slot is in flight. False for frames of the wrong size or type,
+    //and once stop() was called, also while waiting.
+    bool pushFrame(const cv::Mat& frame);
+    //no more frames follow, an incomplete sequence is dropped
+    void finish();
+    //waits for the next unwrapped phase map, false once finish() was called and everything was handed out, or after stop()
+    bool popResult(cv::Mat& unwrapped, uint64_t* sequenceIndex = nullptr);
+    //the consumer gives up: waiting calls return false and sequences still in flight are dropped. Any thread may call it.
+    void stop();
+    //reads the source on a capture thread and hands every decoded map to onResult until it returns false,
+    //returns the number of sequences handed out
+    size_t run(FrameSource& source, const std::function<bool(const cv::Mat&, uint64_t)>& onResult);
+
+private:
+    struct Sequence {
+        std::vector<cv::Mat> fringes;
+        std::vector<cv::Mat> grayCodes;
+        cv::Mat unwrapped;
+        uint64_t index = 0;
+    };
+    void decodeLoop();
+
+    const int width, height, numGrayImages;
+    std::vector<Sequence> pool;
+    SpscRingBuffer<int> freeSlots;//consumer -> capture
+    SpscRingBuffer<int> decodeQueue;//capture -> decoder
+    SpscRingBuffer<int> resultQueue;//decoder -> consumer
+    DoubleThreeStepPhaseShifting decoder;
+    int fillingSlot = -1;
+    int filledFrames = 0;
+    uint64_t nextSequence = 0;
+    std::atomic<bool> inputFinished{false};
+    std::atomic<bool> decodeFinished{false};
+    std::atomic<bool> stopping{false};
+    std::thread decodeThread;
+};
+
+#endif // PHASESTREAMPIPELINE_H
@@ -0,0 +1,509 @@
+#include "PlyIO.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include "Trace.h"
+
+namespace {
+    constexpr size_t writeBlockSize = 4 << 20;
+    //digits reserved for a vertex count that is only known after streaming
+    constexpr int deferredCountDigits = 12;
+
+    bool hostIsLittleEndian()
+    {
+        const uint16_t probe = 1;
+        unsigned char first;
+        std::memcpy(&first, &probe, 1);
+        return first == 1;
+    }
+
+    PlyType parseType(const std::string& name)
+    {
+        if (name == "char" || name == "int8") return PlyType::Int8;
+        if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+        if (name == "short" || name == "int16") return PlyType::Int16;
+        if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+        if (name == "int" || name == "int32") return PlyType::Int32;
+        if (name == "uint" || name == "uint32") return PlyType::UInt32;
+        if (name == "float" || name == "float32") return PlyType::Float32;
+        if (name == "double" || name == "float64") return PlyType::Float64;
+        return PlyType::Invalid;
+    }
+
+    std::vector<std::string> splitWords(const char* begin, const char* end)
+    {
+        std::vector<std::string> words;
+        const char* p = begin;
+        while (p < end) {
+            while (p < end && std::isspace(static_cast<unsigned char>(*p))) ++p;
+            const char* start = p;
+            while (p < end && !std::isspace(static_cast<unsigned char>(*p))) ++p;
+            if (p > start) words.emplace_back(start, p);
+        }
+        return words;
+    }
+
+    template<typename T>
+    T loadValue(const char* p, bool swapBytes)
+    {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, p, sizeof(T));
+        if (swapBytes) std::reverse(bytes, bytes + sizeof(T));
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    float loadAsFloat(const char* p, PlyType type, bool swapBytes)
+    {
+        switch (type) {
+            case PlyType::Int8: return static_cast<float>(loadValue<int8_t>(p, swapBytes));
+            case PlyType::UInt8: return static_cast<float>(loadValue<uint8_t>(p, swapBytes));
+            case PlyType::Int16: return static_cast<float>(loadValue<int16_t>(p, swapBytes));
+            case PlyType::UInt16: return static_cast<float>(loadValue<uint16_t>(p, swapBytes));
+            case PlyType::Int32: return static_cast<float>(loadValue<int32_t>(p, swapBytes));
+            case PlyType::UInt32: return static_cast<float>(loadValue<uint32_t>(p, swapBytes));
+            case PlyType::Float32: return loadValue<float>(p, swapBytes);
+            case PlyType::Float64: return static_cast<float>(loadValue<double>(p, swapBytes));
+            default: return std::numeric_limits<float>::quiet_NaN();
+        }
+    }
+
+    //NaN x marks a missing point in the scans, an infinite or NaN coordinate anywhere is as unusable
+    bool finitePosition(float x, float y, float z)
+    {
+        return std::isfinite(x) && std::isfinite(y) && std::isfinite(z);
+    }
+
+    const char* skipSpaces(const char* p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        return p;
+    }
+
+    const char* channelNames[OrganizedPointCloud::ChannelCount] = {"x", "y", "z", "nx", "ny", "nz"};
+}
+
+size_t plyTypeSize(PlyType type)
+{
+    switch (type) {
+        case PlyType::Int8: case PlyType::UInt8: return 1;
+        case PlyType::Int16: case PlyType::UInt16: return 2;
+        case PlyType::Int32: case PlyType::UInt32: case PlyType::Float32: return 4;
+        case PlyType::Float64: return 8;
+        default: return 0;
+    }
+}
+
+size_t PlyElement::recordSize() const
+{
+    size_t size = 0;
+    for (const auto& property : properties) {
+        if (property.isList) return 0;
+        size += plyTypeSize(property.type);
+    }
+    return size;
+}
+
+bool PlyHeader::parse(const char* data, size_t size, std::string& error)
+{
+    elements.clear();
+    gridRows = gridCols = 0;
+    const char* end = data + size;
+    const char* line = data;
+    bool first = true;
+    while (line < end) {
+        const char* newline = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        const char* lineEnd = newline ? newline : end;
+        auto words = splitWords(line, lineEnd);
+        line = newline ? newline + 1 : end;
+
+        if (first) {
+            if (words.empty() || words[0] != "ply") {
+                error = "not a PLY file";
+                return false;
+            }
+            first = false;
+            continue;
+        }
+        if (words.size() >= 3 && words[0] == "obj_info") {
+            if (words[1] == "num_rows") gridRows = std::atoi(words[2].c_str());
+            else if (words[1] == "num_cols") gridCols = std::atoi(words[2].c_str());
+            continue;
+        }
+        if (words.empty() || words[0] == "comment" || words[0] == "obj_info") continue;
+        if (words[0] == "format" && words.size() >= 2) {
+            if (words[1] == "ascii") format = PlyFormat::Ascii;
+            else if (words[1] == "binary_little_endian") format = PlyFormat::BinaryLittleEndian;
+            else if (words[1] == "binary_big_endian") format = PlyFormat::BinaryBigEndian;
+            else {
+                error = "unknown format " + words[1];
+                return false;
+            }
+        }
+        else if (words[0] == "element" && words.size() >= 3) {
+            PlyElement element;
+            element.name = words[1];
+            element.count = std::strtoull(words[2].c_str(), nullptr, 10);
+            elements.push_back(element);
+        }
+        else if (words[0] == "property" && !elements.empty()) {
+            PlyProperty property;
+            if (words.size() >= 5 && words[1] == "list") {
+                property.isList = true;
+                property.countType = parseType(words[2]);
+                property.type = parseType(words[3]);
+                property.name = words[4];
+            }
+            else if (words.size() >= 3) {
+                property.type = parseType(words[1]);
+                property.name = words[2];
+            }
+            if (property.type == PlyType::Invalid || (property.isList && property.countType == PlyType::Invalid)) {
+                error = "unknown property type";
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        }
+        else if (words[0] == "end_header") {
+            dataOffset = static_cast<size_t>(line - data);
+            return true;
+        }
+    }
+    error = "missing end_header";
+    return false;
+}
+
+const PlyElement* PlyHeader::findElement(const std::string& name) const
+{
+    for (const auto& element : elements) {
+        if (element.name == name) return &element;
+    }
+    return nullptr;
+}
+
+bool PlyReader::open(const std::string& filename)
+{
+    vertices = nullptr;
+    if (!file.open(filename)) {
+        lastError = "unable to open " + filename;
+        return false;
+    }
+    if (!plyHeader.parse(file.data(), file.size(), lastError)) return false;
+
+    size_t offset = plyHeader.dataOffset;
+    for (const auto& element : plyHeader.elements) {
+        if (element.name == "vertex") {
+            vertices = &element;
+            break;
+        }
+        //elements in front of the vertices have to be skipped
+        if (plyHeader.format == PlyFormat::Ascii) {
+            for (size_t i = 0; i < element.count && offset < file.size(); ++i) {
+                const char* newline = static_cast<const char*>(std::memchr(file.data() + offset, '\n', file.size() - offset));
+                offset = newline ? static_cast<size_t>(newline - file.data()) + 1 : file.size();
+            }
+        }
+        else {
+            if (element.recordSize() == 0 && element.count > 0) {
+                lastError = "list elements in front of the vertices are not supported";
+                return false;
+            }
+            offset += element.recordSize() * element.count;
+        }
+    }
+    if (!vertices) {
+        lastError = "no vertex element";
+        return false;
+    }
+    if (plyHeader.format != PlyFormat::Ascii && vertices->recordSize() == 0) {
+        lastError = "vertex element with list properties is not supported";
+        return false;
+    }
+    vertexOffset = offset;
+    asciiCursorVertex = 0;
+    asciiCursorOffset = offset;
+
+    propertyOffsets.assign(vertices->properties.size(), 0);
+    size_t propertyOffset = 0;
+    for (size_t i = 0; i < vertices->properties.size(); ++i) {
+        propertyOffsets[i] = propertyOffset;
+        propertyOffset += plyTypeSize(vertices->properties[i].type);
+    }
+    for (int c = 0; c < OrganizedPointCloud::ChannelCount; ++c) {
+        channelProperty[c] = -1;
+        for (size_t i = 0; i < vertices->properties.size(); ++i) {
+            if (vertices->properties[i].name == channelNames[c] && !vertices->properties[i].isList) {
+                channelProperty[c] = static_cast<int>(i);
+            }
+        }
+    }
+    if (channelProperty[0] < 0 || channelProperty[1] < 0 || channelProperty[2] < 0) {
+        lastError = "vertex element has no x, y, z properties";
+        return false;
+    }
+    packedFloats = vertices->properties.size() == OrganizedPointCloud::ChannelCount;
+    for (int c = 0; c < OrganizedPointCloud::ChannelCount && packedFloats; ++c) {
+        packedFloats = channelProperty[c] == c && vertices->properties[c].type == PlyType::Float32;
+    }
+    return true;
+}
+
+size_t PlyReader::readVertices(size_t first, size_t count, OrganizedPointCloud& cloud, size_t target)
+{
+    KIVI_TRACE_SCOPE("PlyReader::readVertices");
+    if (!vertices) return 0;
+    count = std::min(count, cloud.size() - std::min(target, cloud.size()));
+    size_t available = first < vertices->count ? std::min(count, vertices->count - first) : 0;
+    size_t valid = plyHeader.format == PlyFormat::Ascii ? readAscii(first, available, cloud, target)
+                                                        : readBinary(first, available, cloud, target);
+    KIVI_TRACE_COUNT("ply_vertices_read", static_cast<int64_t>(available));
+    KIVI_TRACE_COUNT("ply_invalid_vertices", static_cast<int64_t>(available - valid));
+    for (size_t i = available; i < count; ++i) {
+        cloud.setInvalid(target + i);
+    }
+    return valid;
+}
+
+void PlyReader::discardBefore(size_t vertex)
+{
+    if (!vertices) return;
+    if (plyHeader.format == PlyFormat::Ascii) {
+        //only the part in front of the cursor is known to be consumed
+        if (vertex >= asciiCursorVertex) file.release(asciiCursorOffset);
+    }
+    else {
+        file.release(vertexOffset + vertex * vertices->recordSize());
+    }
+}
+
+size_t PlyReader::readBinary(size_t first, size_t count, OrganizedPointCloud& cloud, size_t target)
+{
+    const size_t record = vertices->recordSize();
+    const size_t stored = (file.size() - std::min(file.size(), vertexOffset)) / record;
+    const size_t readable = first < stored ? std::min(count, stored - first) : 0;
+    const bool swapBytes = (plyHeader.format == PlyFormat::BinaryLittleEndian) != hostIsLittleEndian();
+    const char* base = file.data() + vertexOffset + first * record;
+    float* channels[OrganizedPointCloud::ChannelCount];
+    for (int c = 0; c < OrganizedPointCloud::ChannelCount; ++c) {
+        channels[c] = cloud.channel(c) + target;
+    }
+    uint8_t* mask = cloud.validMask() + target;
+    size_t valid = 0;
+
+    if (packedFloats && !swapBytes) {
+        //the common layout, de-interleave the records straight from the mapping
+        for (size_t i = 0; i < readable; ++i) {
+            float point[OrganizedPointCloud::ChannelCount];
+            std::memcpy(point, base + i * record, sizeof(point));
+            for (int c = 0; c < OrganizedPointCloud::ChannelCount; ++c) {
+                channels[c][i] = point[c];
+            }
+            mask[i] = finitePosition(point[0], point[1], point[2]);
+            valid += mask[i];
+        }
+    }
+    else {
+        for (size_t i = 0; i < readable; ++i) {
+            const char* p = base + i * record;
+            for (int c = 0; c < OrganizedPointCloud::ChannelCount; ++c) {
+                int property = channelProperty[c];
+                channels[c][i] = property < 0 ? 0.0f
+                        : loadAsFloat(p + propertyOffsets[property], vertices->properties[property].type, swapBytes);
+            }
+            mask[i] = finitePosition(channels[0][i], channels[1][i], channels[2][i]);
+            valid += mask[i];
+        }
+    }
+    for (size_t i = readable; i < count; ++i) {
+        cloud.setInvalid(target + i);
+    }
+    return valid;
+}
+
+size_t PlyReader::readAscii(size_t first, size_t count, OrganizedPointCloud& cloud, size_t target)
+{
+    const char* data = file.data();
+    const char* end = data + file.size();
+    if (first < asciiCursorVertex) {
+        asciiCursorVertex = 0;
+        asciiCursorOffset = vertexOffset;
+    }
+    const char* line = data + asciiCursorOffset;
+    auto nextLine = [&](const char* p) {
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        return newline ? newline + 1 : end;
+    };
+    for (; asciiCursorVertex < first && line < end; ++asciiCursorVertex) {
+        line = nextLine(line);
+    }
+
+    const size_t propertyCount = vertices->properties.size();
+    size_t valid = 0;
+    size_t i = 0;
+    for (; i < count && line < end; ++i) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        if (!lineEnd) lineEnd = end;
+        float values[OrganizedPointCloud::ChannelCount] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        bool parsed = true;
+        const char* p = line;
+        //a line holds one vertex, values that are not a point channel are parsed and dropped
+        for (size_t property = 0; property < propertyCount && parsed; ++property) {
+            p = skipSpaces(p, lineEnd);
+            float value;
+            auto result = std::from_chars(p, lineEnd, value);
+            if (result.ec != std::errc()) {
+                parsed = false;
+                break;
+            }
+            p = result.ptr;
+            for (int c = 0; c < OrganizedPointCloud::ChannelCount; ++c) {
+                if (channelProperty[c] == static_cast<int>(property)) values[c] = value;
+            }
+        }
+        if (parsed && finitePosition(values[0], values[1], values[2])) {
+            cloud.setPoint(target + i, values[0], values[1], values[2], values[3], values[4], values[5]);
+            ++valid;
+        }
+        else {
+            cloud.setInvalid(target + i);
+        }
+        line = lineEnd < end ? lineEnd + 1 : end;
+    }
+    for (; i < count; ++i) {
+        cloud.setInvalid(target + i);
+    }
+    asciiCursorVertex = first + count;
+    asciiCursorOffset = static_cast<size_t>(line - data);
+    return valid;
+}
+
+PlyWriter::~PlyWriter()
+{
+    close();
+}
+
+bool PlyWriter::open(const std::string& filename, PlyFormat format, size_t vertexCount)
+{
+    deferredCount = false;
+    return writeHeader(filename, format, std::to_string(vertexCount));
+}
+
+bool PlyWriter::open(const std::string& filename, PlyFormat format)
+{
+    deferredCount = true;
+    return writeHeader(filename, format, std::string(deferredCountDigits, '0'));
+}
+
+bool PlyWriter::writeHeader(const std::string& filename, PlyFormat format, const std::string& countField)
+{
+    close();
+    out.open(filename, std::ios::binary);
+    if (!out) return false;
+    plyFormat = format;
+    buffer.resize(writeBlockSize);
+    used = 0;
+    writtenVertices = 0;
+
+    std::string header = "ply\n";
+    switch (format) {
+        case PlyFormat::Ascii: header += "format ascii 1.0\n"; break;
+        case PlyFormat::BinaryLittleEndian: header += "format binary_little_endian 1.0\n"; break;
+        case PlyFormat::BinaryBigEndian: header += "format binary_big_endian 1.0\n"; break;
+    }
+    if (gridRows > 0 && gridCols > 0) {
+        header += "obj_info num_cols " + std::to_string(gridCols) + "\n";
+        header += "obj_info num_rows " + std::to_string(gridRows) + "\n";
+    }
+    header += "element vertex ";
+    countFieldOffset = static_cast<std::streamoff>(header.size());
+    header += countField + "\n";
+    for (const char* name : channelNames) {
+        header += std::string("property float ") + name + "\n";
+    }
+    header += "element face 0\n";
+    header += "property list uchar int vertex_indices\n";
+    header += "end_header\n";
+    out.write(header.data(), static_cast<std::streamsize>(header.size()));
+    return static_cast<bool>(out);
+}
+
+void PlyWriter::flush()
+{
+    out.write(buffer.data(), static_cast<std::streamsize>(used));
+    used = 0;
+}
+
+size_t PlyWriter::writePoints(const OrganizedPointCloud& cloud, size_t first, size_t count, bool organized)
+{
+    const float* channels[OrganizedPointCloud::ChannelCount];
+    for (int c = 0; c < OrganizedPointCloud::ChannelCount; ++c) {
+        channels[c] = cloud.channel(c);
+    }
+    const bool swapBytes = (plyFormat == PlyFormat::BinaryBigEndian) == hostIsLittleEndian();
+    //longest shortest-round-trip float is 15 characters
+    const size_t maxRecord = plyFormat == PlyFormat::Ascii ? OrganizedPointCloud::ChannelCount * 16 + 1
+                                                           : OrganizedPointCloud::ChannelCount * sizeof(float);
+    size_t written = 0;
+    for (size_t i = first; i < first + count; ++i) {
+        if (!organized && !cloud.isValid(i)) continue;
+        if (used + maxRecord > buffer.size()) flush();
+        char* p = buffer.data() + used;
+        if (plyFormat == PlyFormat::Ascii) {
+            char* end = buffer.data() + buffer.size();
+            for (int c = 0; c < OrganizedPointCloud::ChannelCount; ++c) {
+                if (c > 0) *p++ = ' ';
+                p = std::to_chars(p, end, channels[c][i]).ptr;
+            }
+            *p++ = '\n';
+        }
+        else {
+            for (int c = 0; c < OrganizedPointCloud::ChannelCount; ++c) {
+                std::memcpy(p, &channels[c][i], sizeof(float));
+                if (swapBytes) std::reverse(p, p + sizeof(float));
+                p += sizeof(float);
+            }
+        }
+        used = static_cast<size_t>(p - buffer.data());
+        ++written;
+    }
+    writtenVertices += written;
+    return written;
+}
+
+bool PlyWriter::close()
+{
+    if (!out.is_open()) return true;
+    flush();
+    if (deferredCount) {
+        //zero padded so the header keeps its size
+        std::string count = std::to_string(writtenVertices);
+        count.insert(0, deferredCountDigits - std::min<size_t>(count.size(), deferredCountDigits), '0');
+        out.seekp(countFieldOffset);
+        out.write(count.data(), static_cast<std::streamsize>(count.size()));
+        deferredCount = false;
+    }
+    bool ok = static_cast<bool>(out);
+    out.close();
+    return ok;
+}
+
+void PlyWriter::setGrid(int rows, int cols)
+{
+    gridRows = rows;
+    gridCols = cols;
+}
+
+bool PlyWriter::write(const std::string& filename, const OrganizedPointCloud& cloud, bool organized, PlyFormat format)
+{
+    KIVI_TRACE_SCOPE("PlyWriter::write");
+    PlyWriter writer;
+    if (organized) writer.setGrid(cloud.width(), cloud.height());
+    if (!writer.open(filename, format, organized ? cloud.size() : cloud.validCount())) return false;
+    writer.writePoints(cloud, 0, cloud.size(), organized);
+    return writer.close();
+}
@@ -0,0 +1,107 @@
+#ifndef PLYIO_H
+#define PLYIO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+#include "OrganizedPointCloud.h"
+
+enum class PlyFormat { Ascii, BinaryLittleEndian, BinaryBigEndian };
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Invalid };
+
+struct PlyProperty {
+    std::string name;
+    PlyType type = PlyType::Invalid;
+    bool isList = false;
+    PlyType countType = PlyType::Invalid;//type of the list length
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+    //bytes of one binary record, 0 when the element has list properties
+    size_t recordSize() const;
+};
+
+//Header of a PLY file. Accepts \n and \r\n line endings, comments and obj_info lines.
+struct PlyHeader {
+    PlyFormat format = PlyFormat::Ascii;
+    std::vector<PlyElement> elements;
+    size_t dataOffset = 0;//first byte after end_header
+    //organized size from "obj_info num_rows" and "obj_info num_cols" as PCL writes them, 0 when absent.
+    //Vertex r * gridCols + c is point (r, c), so rows are the x and columns the y of an OrganizedPointCloud.
+    int gridRows = 0, gridCols = 0;
+
+    bool parse(const char* data, size_t size, std::string& error);
+    const PlyElement* findElement(const std::string& name) const;
+};
+
+size_t plyTypeSize(PlyType type);
+
+//Reads the vertex element of a PLY file into an organized point cloud.
+//Binary files are decoded straight from the memory mapping, ASCII files are parsed with std::from_chars.
+class PlyReader {
+public:
+    bool open(const std::string& filename);
+    const PlyHeader& header() const { return plyHeader; }
+    const std::string& error() const { return lastError; }
+    size_t vertexCount() const { return vertices ? vertices->count : 0; }
+
+    //reads vertices [first, first + count) into the points [target, target + count) of cloud.
+    //Vertices without a parsable or finite position are marked invalid. Returns the number of valid points.
+    //ASCII files keep a cursor, so consecutive ranges are read without rescanning the file.
+    size_t readVertices(size_t first, size_t count, OrganizedPointCloud& cloud, size_t target);
+    //tells the reader that vertices before the given one are not needed again, their pages are released
+    void discardBefore(size_t vertex);
+
+private:
+    size_t readBinary(size_t first, size_t count, OrganizedPointCloud& cloud, size_t target);
+    size_t readAscii(size_t first, size_t count, OrganizedPointCloud& cloud, size_t target);
+
+    MappedFile file;
+    PlyHeader plyHeader;
+    std::string lastError;
+    const PlyElement* vertices = nullptr;
+    size_t vertexOffset = 0;//byte offset of the vertex element
+    int channelProperty[OrganizedPointCloud::ChannelCount] = {-1, -1, -1, -1, -1, -1};
+    std::vector<size_t> propertyOffsets;
+    bool packedFloats = false;//x y z nx ny nz float32 and nothing else
+    size_t asciiCursorVertex = 0;
+    size_t asciiCursorOffset = 0;
+};
+
+//Writes organized point clouds as PLY with x y z nx ny nz float properties.
+//Binary output is interleaved into a large buffer and written in blocks, ASCII uses std::to_chars.
+class PlyWriter {
+public:
+    ~PlyWriter();
+    bool open(const std::string& filename, PlyFormat format, size_t vertexCount);
+    //for streamed output, the vertex count field is reserved in the header and filled in by close()
+    bool open(const std::string& filename, PlyFormat format);
+    //appends the points [first, first + count) of cloud, only valid ones unless organized is set
+    size_t writePoints(const OrganizedPointCloud& cloud, size_t first, size_t count, bool organized);
+    bool close();
+    //organized files record their size as obj_info lines, call before open
+    void setGrid(int rows, int cols);
+
+    static bool write(const std::string& filename, const OrganizedPointCloud& cloud, bool organized, PlyFormat format);
+
+private:
+    void flush();
+    bool writeHeader(const std::string& filename, PlyFormat format, const std::string& countField);
+
+    std::ofstream out;
+    PlyFormat plyFormat = PlyFormat::BinaryLittleEndian;
+    std::vector<char> buffer;
+    size_t used = 0;
+    size_t writtenVertices = 0;
+    bool deferredCount = false;
+    int gridRows = 0, gridCols = 0;
+    std::streamoff countFieldOffset = 0;
+};
+
+#endif // PLYIO_H
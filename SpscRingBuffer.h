@@ -0,0 +1,54 @@
+#ifndef SPSCRINGBUFFER_H
+#define SPSCRINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+//Lock-free ring buffer for exactly one producer thread and one consumer thread.
+//Head and tail live on separate cache lines so the two sides do not share a line while they run.
+template<typename T>
+class SpscRingBuffer {
+public:
+    //capacity is rounded up to a power of two
+    explicit SpscRingBuffer(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    bool tryPush(const T& value)
+    {
+        const size_t tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - headIndex.load(std::memory_order_acquire) > mask) return false;//full
+        slots[tail & mask] = value;
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value)
+    {
+        const size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire)) return false;//empty
+        value = slots[head & mask];
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return headIndex.load(std::memory_order_acquire) == tailIndex.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    std::vector<T> slots;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> headIndex{0};
+    alignas(64) std::atomic<size_t> tailIndex{0};
+};
+
+#endif // SPSCRINGBUFFER_H
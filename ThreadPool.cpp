@@ -0,0 +1,81 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount)
+{
+    if (threadCount <= 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 1; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::runChunks()
+{
+    for (;;) {
+        int begin = nextItem.fetch_add(jobGrain, std::memory_order_relaxed);
+        if (begin >= jobCount) break;
+        jobFunction(jobContext, begin, std::min(begin + jobGrain, jobCount));
+    }
+}
+
+void ThreadPool::workerLoop()
+{
+    unsigned long seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeUp.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        runChunks();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busyWorkers;
+        }
+        finished.notify_one();
+    }
+}
+
+void ThreadPool::run(int count, int grain, ChunkFunction function, const void* context)
+{
+    if (count <= 0) return;
+    grain = std::max(1, grain);
+    //nothing to share, run inline
+    if (workers.empty() || count <= grain) {
+        for (int begin = 0; begin < count; begin += grain) {
+            function(context, begin, std::min(begin + grain, count));
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobFunction = function;
+        jobContext = context;
+        jobCount = count;
+        jobGrain = grain;
+        nextItem.store(0, std::memory_order_relaxed);
+        busyWorkers = static_cast<int>(workers.size());
+        ++generation;
+    }
+    wakeUp.notify_all();
+    runChunks();
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return busyWorkers == 0; });
+    jobFunction = nullptr;
+    jobContext = nullptr;
+}
@@ -0,0 +1,50 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed size pool for data parallel loops.
+//parallelFor hands out chunks of the range through a shared atomic counter, so threads that finish
+//early keep taking work from the slower ones. The calling thread takes part in every loop.
+class ThreadPool {
+public:
+    //threadCount <= 0 uses every hardware thread
+    explicit ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+    //calls body(begin, end) for consecutive chunks of [0, count) holding at most grain items.
+    //The body is passed on as a function pointer and its address, not wrapped in a std::function, so a loop does not allocate.
+    template<typename Body>
+    void parallelFor(int count, int grain, const Body& body)
+    {
+        run(count, grain, [](const void* context, int begin, int end) { (*static_cast<const Body*>(context))(begin, end); }, &body);
+    }
+
+private:
+    using ChunkFunction = void (*)(const void* context, int begin, int end);
+    void run(int count, int grain, ChunkFunction function, const void* context);
+    void workerLoop();
+    void runChunks();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable finished;
+    ChunkFunction jobFunction = nullptr;
+    const void* jobContext = nullptr;
+    int jobCount = 0;
+    int jobGrain = 1;
+    std::atomic<int> nextItem{0};
+    int busyWorkers = 0;
+    unsigned long generation = 0;
+    bool stopping = false;
+};
+
+#endif // THREADPOOL_H
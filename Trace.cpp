@@ -0,0 +1,253 @@
+#include "Trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+std::atomic<bool> Trace::active{false};
+
+namespace {
+    struct Event {
+        const char* name;
+        int64_t start, duration;
+        int64_t cycles, instructions;
+    };
+
+    struct Counter {
+        const char* name;
+        int64_t value;
+    };
+
+    //written by its own thread only, read when the trace is written
+    struct ThreadBuffer {
+        int threadId = 0;
+        std::vector<Event> events;
+        std::vector<Counter> counters;
+        bool hardwareOpened = false;
+        int cyclesFd = -1;
+        int instructionsFd = -1;
+
+        ~ThreadBuffer()
+        {
+#ifdef __linux__
+            if (cyclesFd >= 0) close(cyclesFd);
+            if (instructionsFd >= 0) close(instructionsFd);
+#endif
+        }
+    };
+
+    //taken once per thread and when the trace starts or is written, never per event
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> threadBuffers;
+    std::deque<std::string> internedNames;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::atomic<bool> hardwareRequested{false};
+    std::atomic<bool> hardwareWarned{false};
+
+    ThreadBuffer& threadBuffer()
+    {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            threadBuffers.push_back(std::make_unique<ThreadBuffer>());
+            buffer = threadBuffers.back().get();
+            buffer->threadId = static_cast<int>(threadBuffers.size());
+            buffer->events.reserve(1024);
+        }
+        return *buffer;
+    }
+
+#ifdef __linux__
+    int openHardwareCounter(uint64_t config)
+    {
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = config;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        //this thread on any CPU
+        return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+    }
+#endif
+
+    void openHardwareCounters(ThreadBuffer& buffer)
+    {
+        buffer.hardwareOpened = true;
+#ifdef __linux__
+        buffer.cyclesFd = openHardwareCounter(PERF_COUNT_HW_CPU_CYCLES);
+        buffer.instructionsFd = openHardwareCounter(PERF_COUNT_HW_INSTRUCTIONS);
+        if (buffer.cyclesFd >= 0 && buffer.instructionsFd >= 0) return;
+        const int error = errno;
+        if (buffer.cyclesFd >= 0) close(buffer.cyclesFd);
+        if (buffer.instructionsFd >= 0) close(buffer.instructionsFd);
+        buffer.cyclesFd = buffer.instructionsFd = -1;
+        if (!hardwareWarned.exchange(true)) {
+            std::cerr << "Hardware counters unavailable: " << std::strerror(error) << std::endl;
+        }
+#else
+        if (!hardwareWarned.exchange(true)) {
+            std::cerr << "Hardware counters need perf_event_open (Linux)" << std::endl;
+        }
+#endif
+    }
+
+    int64_t readCounter(int fd)
+    {
+#ifdef __linux__
+        uint64_t value = 0;
+        if (fd >= 0 && read(fd, &value, sizeof(value)) == sizeof(value)) return static_cast<int64_t>(value);
+#else
+        (void)fd;
+#endif
+        return -1;
+    }
+
+    void writeString(std::ostream& out, const char* text)
+    {
+        out << '"';
+        for (const char* c = text; *c; ++c) {
+            if (*c == '"' || *c == '\\') out << '\\';
+            out << *c;
+        }
+        out << '"';
+    }
+}
+
+void Trace::enable(bool hardwareCounters)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto& buffer : threadBuffers) {
+        buffer->events.clear();
+        buffer->counters.clear();
+    }
+    origin = std::chrono::steady_clock::now();
+    hardwareRequested = hardwareCounters;
+    active.store(true, std::memory_order_release);
+}
+
+void Trace::disable()
+{
+    active.store(false, std::memory_order_release);
+}
+
+const char* Trace::intern(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const std::string& interned : internedNames) {
+        if (interned == name) return interned.c_str();
+    }
+    internedNames.push_back(name);
+    return internedNames.back().c_str();
+}
+
+int64_t Trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void Trace::count(const char* name, int64_t value)
+{
+    ThreadBuffer& buffer = threadBuffer();
+    for (Counter& counter : buffer.counters) {
+        if (counter.name == name) {
+            counter.value += value;
+            return;
+        }
+    }
+    buffer.counters.push_back({name, value});
+}
+
+void Trace::readHardware(HardwareSample& sample)
+{
+    if (!hardwareRequested.load(std::memory_order_relaxed)) return;
+    ThreadBuffer& buffer = threadBuffer();
+    if (!buffer.hardwareOpened) openHardwareCounters(buffer);
+    sample.cycles = readCounter(buffer.cyclesFd);
+    sample.instructions = readCounter(buffer.instructionsFd);
+}
+
+void TraceScope::begin(const char* name)
+{
+    scopeName = name;
+    Trace::readHardware(hardware);
+    start = Trace::now();
+}
+
+void Trace::record(const char* name, int64_t start, const HardwareSample& begin)
+{
+    const int64_t end = now();
+    HardwareSample finish;
+    readHardware(finish);
+    Event event = {name, start, end - start, -1, -1};
+    if (begin.cycles >= 0 && finish.cycles >= 0) event.cycles = finish.cycles - begin.cycles;
+    if (begin.instructions >= 0 && finish.instructions >= 0) event.instructions = finish.instructions - begin.instructions;
+    threadBuffer().events.push_back(event);
+}
+
+bool Trace::writeChromeTrace(const std::string& filename)
+{
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(registryMutex);
+    //counters of the same name may come from different literals, so they are merged by content
+    std::map<std::string, int64_t> totals;
+    int64_t end = 0;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"Kivi\"}}";
+    for (const auto& buffer : threadBuffers) {
+        if (buffer->events.empty() && buffer->counters.empty()) continue;
+        out << ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->threadId
+            << ", \"args\": {\"name\": \"thread " << buffer->threadId << "\"}}";
+        for (const Event& event : buffer->events) {
+            out << ",\n  {\"name\": ";
+            writeString(out, event.name);
+            out << ", \"cat\": \"kivi\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadId
+                << ", \"ts\": " << event.start * 1e-3 << ", \"dur\": " << event.duration * 1e-3;
+            if (event.cycles >= 0) {
+                out << ", \"args\": {\"cycles\": " << event.cycles << ", \"instructions\": " << event.instructions << "}";
+            }
+            out << "}";
+            end = std::max(end, event.start + event.duration);
+        }
+        for (const Counter& counter : buffer->counters) totals[counter.name] += counter.value;
+    }
+    for (const auto& total : totals) {
+        out << ",\n  {\"name\": ";
+        writeString(out, total.first.c_str());
+        out << ", \"ph\": \"C\", \"pid\": 1, \"ts\": " << end * 1e-3 << ", \"args\": {\"value\": " << total.second << "}}";
+    }
+    out << "\n], \"otherData\": {";
+    bool first = true;
+    for (const auto& total : totals) {
+        out << (first ? "" : ", ");
+        writeString(out, total.first.c_str());
+        out << ": " << total.second;
+        first = false;
+    }
+    out << "}}\n";
+    if (!out) {
+        std::cerr << "Error writing file: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,75 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+//Scoped timers and counters of the hot paths, written as Chrome trace JSON (chrome://tracing or Perfetto).
+//The scopes are compiled in unless KIVI_NO_TRACING is defined and record nothing until enable() is called,
+//a disabled scope costs one relaxed atomic load. An enabled scope appends one event to the buffer of its own
+//thread and counters add to per-thread totals, so the hot path takes no lock. The buffers are merged when the
+//trace is written. With hardware counters every thread opens a cycle and an instruction counter through
+//perf_event_open on its first scope, where this is not available or not permitted the events carry no counters.
+//Names must outlive the trace: string literals, or intern() for names built at runtime.
+class Trace {
+public:
+    struct HardwareSample {
+        int64_t cycles = -1;
+        int64_t instructions = -1;
+    };
+
+    //starts a new trace, earlier events and counters are dropped
+    static void enable(bool hardwareCounters = false);
+    static void disable();
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+    //stable copy of a runtime name
+    static const char* intern(const std::string& name);
+    //adds value to the counter of the calling thread, the trace holds the sum over all threads
+    static void count(const char* name, int64_t value);
+    //nanoseconds since enable
+    static int64_t now();
+    //call when no scope is open on any thread, e.g. at the end of a run
+    static bool writeChromeTrace(const std::string& filename);
+
+private:
+    friend class TraceScope;
+    static void readHardware(HardwareSample& sample);
+    static void record(const char* name, int64_t start, const HardwareSample& begin);
+
+    static std::atomic<bool> active;
+};
+
+//Records the time between construction and destruction as one event of the calling thread.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name)
+    {
+        if (name && Trace::enabled()) begin(name);
+    }
+    ~TraceScope()
+    {
+        if (scopeName) Trace::record(scopeName, start, hardware);
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    void begin(const char* name);
+
+    const char* scopeName = nullptr;
+    int64_t start = 0;
+    Trace::HardwareSample hardware;
+};
+
+#ifdef KIVI_NO_TRACING
+#define KIVI_TRACE_SCOPE(name) ((void)0)
+#define KIVI_TRACE_COUNT(name, value) ((void)0)
+#else
+#define KIVI_TRACE_CONCAT_(a, b) a##b
+#define KIVI_TRACE_CONCAT(a, b) KIVI_TRACE_CONCAT_(a, b)
+#define KIVI_TRACE_SCOPE(name) TraceScope KIVI_TRACE_CONCAT(kiviTraceScope, __LINE__)(name)
+#define KIVI_TRACE_COUNT(name, value) do { if (Trace::enabled()) Trace::count(name, value); } while (0)
+#endif
+
+#endif // TRACE_H
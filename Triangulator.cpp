@@ -0,0 +1,94 @@
+#include "Triangulator.h"
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include "FrameArena.h"
+#include "Trace.h"
+
+Triangulator::Triangulator(const CameraIntrinsics& intrinsics)
+        : intrinsics(intrinsics) {}
+
+void Triangulator::computeNormals(OrganizedPointCloud& cloud, int firstColumn, int lastColumn) const
+{
+    const int width = cloud.width(), height = cloud.height();
+    const float* px = cloud.channel(OrganizedPointCloud::X);
+    const float* py = cloud.channel(OrganizedPointCloud::Y);
+    const float* pz = cloud.channel(OrganizedPointCloud::Z);
+    float* nx = cloud.channel(OrganizedPointCloud::NX);
+    float* ny = cloud.channel(OrganizedPointCloud::NY);
+    float* nz = cloud.channel(OrganizedPointCloud::NZ);
+    uint8_t* valid = cloud.validMask();
+    const float noNormal = std::numeric_limits<float>::quiet_NaN();
+
+    //the positions were all written before, only the normal planes and the mask of these columns change here
+    for (int x = firstColumn; x < lastColumn; ++x) {
+        for (int y = 0; y < height; ++y) {
+            const size_t i = cloud.index(x, y);
+            if (!valid[i]) continue;
+            //neighbors whose position is finite, the mask of other columns may already have been cleared
+            auto usable = [&](int column, int row) {
+                return column >= 0 && column < width && row >= 0 && row < height && std::isfinite(pz[cloud.index(column, row)]);
+            };
+            const int left = usable(x - 1, y) ? x - 1 : x, right = usable(x + 1, y) ? x + 1 : x;
+            const int up = usable(x, y - 1) ? y - 1 : y, down = usable(x, y + 1) ? y + 1 : y;
+            if (left == right || up == down) {
+                valid[i] = 0;
+                nx[i] = ny[i] = nz[i] = noNormal;
+                continue;
+            }
+            const size_t l = cloud.index(left, y), r = cloud.index(right, y);
+            const size_t u = cloud.index(x, up), d = cloud.index(x, down);
+            const float ax = px[r] - px[l], ay = py[r] - py[l], az = pz[r] - pz[l];
+            const float bx = px[d] - px[u], by = py[d] - py[u], bz = pz[d] - pz[u];
+            float cx = ay * bz - az * by, cy = az * bx - ax * bz, cz = ax * by - ay * bx;
+            float length = std::sqrt(cx * cx + cy * cy + cz * cz);
+            if (!(length > 0.0f)) {
+                valid[i] = 0;
+                nx[i] = ny[i] = nz[i] = noNormal;
+                continue;
+            }
+            //the camera sits at the origin, flip normals that point away from it
+            if (cx * px[i] + cy * py[i] + cz * pz[i] > 0.0f) length = -length;
+            nx[i] = cx / length;
+            ny[i] = cy / length;
+            nz[i] = cz / length;
+        }
+    }
+}
+
+void Triangulator::triangulate(const cv::Mat& disparity, OrganizedPointCloud& cloud) const
+{
+    KIVI_TRACE_SCOPE("triangulate");
+    if (disparity.type() != CV_32FC1) {
+        std::cerr << "Triangulation needs a CV_32FC1 disparity map" << std::endl;
+        return;
+    }
+    const int width = disparity.cols, height = disparity.rows;
+    cloud.resize(width, height);
+    const float depthScale = intrinsics.fx * intrinsics.baseline;
+    //columns are contiguous in the cloud, so they are the unit of work
+    parallelRows(cv::Range(0, width), [&](const cv::Range& range) {
+        float* px = cloud.channel(OrganizedPointCloud::X);
+        float* py = cloud.channel(OrganizedPointCloud::Y);
+        float* pz = cloud.channel(OrganizedPointCloud::Z);
+        for (int x = range.start; x < range.end; ++x) {
+            for (int y = 0; y < height; ++y) {
+                const size_t i = cloud.index(x, y);
+                const float d = disparity.at<float>(y, x);
+                if (!(d > 0.0f)) {//also catches NaN
+                    cloud.setInvalid(i);
+                    continue;
+                }
+                const float z = depthScale / d;
+                px[i] = (static_cast<float>(x) - intrinsics.cx) * z / intrinsics.fx;
+                py[i] = (static_cast<float>(y) - intrinsics.cy) * z / intrinsics.fy;
+                pz[i] = z;
+                cloud.validMask()[i] = 1;
+            }
+        }
+    });
+    parallelRows(cv::Range(0, width), [&](const cv::Range& range) {
+        computeNormals(cloud, range.start, range.end);
+    });
+}
@@ -0,0 +1,32 @@
+#ifndef TRIANGULATOR_H
+#define TRIANGULATOR_H
+
+#include <opencv2/opencv.hpp>
+#include "OrganizedPointCloud.h"
+
+//Pinhole intrinsics of the rectified left camera and the stereo baseline, in pixels and scene units.
+struct CameraIntrinsics {
+    float fx = 1.0f, fy = 1.0f;
+    float cx = 0.0f, cy = 0.0f;
+    float baseline = 1.0f;
+};
+
+//Turns a rectified disparity map into an organized point cloud.
+//Pixel (u, v) becomes point (u, v) of a cols x rows cloud with z = fx * baseline / d. Normals are the cross
+//product of the horizontal and vertical neighbor differences (central where both neighbors are valid,
+//one-sided otherwise) and face the camera. Pixels with NaN or non-positive disparity, and points without a
+//neighbor in each direction, are invalid.
+class Triangulator {
+public:
+    explicit Triangulator(const CameraIntrinsics& intrinsics);
+
+    //disparity is CV_32FC1, cloud is resized to disparity.cols x disparity.rows and fully overwritten
+    void triangulate(const cv::Mat& disparity, OrganizedPointCloud& cloud) const;
+
+private:
+    void computeNormals(OrganizedPointCloud& cloud, int firstColumn, int lastColumn) const;
+
+    CameraIntrinsics intrinsics;
+};
+
+#endif // TRIANGULATOR_H
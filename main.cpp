@@ -1,14 +1,278 @@
 #include "BilateralFilter.h"
 #include "CorrespondenceMatching.h"
 #include "DoubleThreeStepPhaseShifting.h"
-int main() {
+#include "KiviPipeline.h"
+#include "BatchProcessor.h"
+#include "Trace.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+    void printUsage(const char* program)
+    {
+        std::cout << "Usage: " << program << " [options]\n"
+                  << "Without options the bilateral filter runs on 3D-bilateral/OriginalMesh.ply.\n"
+                  << "  --decode-phase            decode the fringe and Gray-code images\n"
+                  << "  --gray-prefix <prefix>    Gray-code images <prefix>0.png ... (default double-three-step/gray_pattern_)\n"
+                  << "  --phase-out <file.kphm>   write the unwrapped phase\n"
+                  << "  --phase-size <w> <h>      pattern size (default 1280 720), 0 0 uses the Gray-code image size\n"
+                  << "  --phase-step <degrees>    phase step of the fringe sets, decoded with (1 - cos d) / sin d\n"
+                  << "  --fringes <n>             fringes across the width (default 128), sets the Gray-code image count\n"
+                  << "  --synthetic-gray          decode the generated Gray-code patterns instead of captured images\n"
+                  << "  --pattern-cache <dir>     keep the generated pattern rows in <dir> between runs\n"
+                  << "  --write-patterns <dir>    write the projector sequence of the phase options as PNG files\n"
+                  << "  --min-modulation <b>      mask pixels whose fringe modulation is below b gray levels (NaN in the phase)\n"
+                  << "  --correct-orders <r>      correct fringe orders within r pixels of a 2 pi phase jump against the median phase\n"
+                  << "  --left <map> --right <map>  phase maps (.kphm or .csv) for correspondence and triangulation\n"
+                  << "  --method <phase|block>    correspondence method (default phase)\n"
+                  << "  --fx <f> --fy <f> --cx <c> --cy <c> --baseline <b>  camera (default 1000, 1000, image center, 100)\n"
+                  << "  --ply-in <file>           filter this mesh when no phase maps are given\n"
+                  << "  --ply-out <file>          write the filtered cloud\n"
+                  << "  --mesh-size <w> <h>       organized size of --ply-in and batch meshes (default 2592 1944), 0 0 reads the PLY header\n"
+                  << "  --stream-bands <rows>     filter --ply-in into --ply-out in bands of rows, without loading the whole mesh\n"
+                  << "  --iterations <n>          bilateral filter iterations (default 10)\n"
+                  << "  --radius <r>              filter window (2r+1)x(2r+1), 2 to 7 weight by 3D distance and normals (default 1)\n"
+                  << "  --sigmas <spatial> <range>  spatial sigma in points and normal sigma (default exp(-12) each)\n"
+                  << "  --distance-sigma <d>      3D distance sigma of radius 2 and up, 0 ignores distance (default 0)\n"
+                  << "  --full-window             visit the whole window instead of a y pass and an x pass\n"
+                  << "  --double                  double precision phase and filter accumulation\n"
+                  << "  --reference <raw> <filtered>  earlier scan and its filtered mesh, only changed regions are filtered again\n"
+                  << "  --organized-output        keep invalid points in --ply-out, needed for a --reference mesh\n"
+                  << "  --tolerance <t>           change threshold of --reference per coordinate and normal (default 1e-4)\n"
+                  << "  --compact-out <file.kpc>  keep the cloud as depth and 32-bit normal per point, filter and write it in that form,\n"
+                  << "                            only for --left/--right clouds and radius 1 without --double\n"
+                  << "  --no-filter               skip the bilateral filter\n"
+                  << "  --threads <n>             filter threads, 0 uses every hardware thread\n"
+                  << "  --thread-scaling <n>      filter --ply-in with 1 to n threads, print the speedups and check the results match\n"
+                  << "  --headless                no windows\n"
+                  << "  --metrics <file|->        write stage timings as JSON, - for stdout\n"
+                  << "  --trace <file.json>       record the timers and counters of the hot paths as a Chrome trace\n"
+                  << "  --trace-hw                add cycles and instructions per scope (perf_event_open, Linux)\n"
+                  << "  --batch-manifest <file>   filter every \"input output\" pair of the manifest\n"
+                  << "  --batch-dir <in> <out>    filter every .ply file of a directory\n"
+                  << "  --io-threads <n>          batch reader and writer threads (default 2 each)\n";
+    }
+
+    struct BatchOptions {
+        std::string manifest;
+        std::string inputDirectory;
+        std::string outputDirectory;
+        int ioThreads = 2;
+    };
+
+    struct ReportOptions {
+        std::string metricsFile;
+        std::string traceFile;
+        bool traceHardware = false;
+        int threadScaling = 0;//highest thread count of --thread-scaling, 0 runs the pipeline
+    };
+
+    //false on unknown options or missing values
+    bool parseArguments(int argc, char** argv, PipelineConfig& config, BatchOptions& batch, ReportOptions& report)
+    {
+        config.intrinsics.fx = config.intrinsics.fy = 1000.0f;
+        config.intrinsics.baseline = 100.0f;
+        for (int i = 1; i < argc; ++i) {
+            const std::string option = argv[i];
+            auto value = [&](std::string& target) {
+                if (i + 1 >= argc) return false;
+                target = argv[++i];
+                return true;
+            };
+            std::string text;
+            if (option == "--decode-phase") config.decodePhase = true;
+            else if (option == "--headless") config.headless = true;
+            else if (option == "--no-filter") config.filter = false;
+            else if (option == "--gray-prefix") { if (!value(config.phaseShifting.grayCodePrefix)) return false; }
+            else if (option == "--phase-out") { if (!value(config.phaseOutput)) return false; }
+            else if (option == "--synthetic-gray") config.phaseShifting.grayCodePrefix.clear();
+            else if (option == "--pattern-cache") { if (!value(config.phaseShifting.patternCacheDirectory)) return false; }
+            else if (option == "--write-patterns") { if (!value(config.patternOutput)) return false; }
+            else if (option == "--fringes") {
+                if (!value(text)) return false;
+                config.phaseShifting.fringes = std::strtod(text.c_str(), nullptr);
+            }
+            else if (option == "--min-modulation") {
+                if (!value(text)) return false;
+                config.phaseShifting.minModulation = std::strtof(text.c_str(), nullptr);
+            }
+            else if (option == "--correct-orders") {
+                if (!value(text)) return false;
+                config.phaseShifting.orderCorrectionRadius = std::atoi(text.c_str());
+            }
+            else if (option == "--left") { if (!value(config.leftPhaseMap)) return false; }
+            else if (option == "--right") { if (!value(config.rightPhaseMap)) return false; }
+            else if (option == "--ply-in") { if (!value(config.inputPly)) return false; }
+            else if (option == "--ply-out") { if (!value(config.outputPly)) return false; }
+            else if (option == "--compact-out") { if (!value(config.compactOutput)) return false; }
+            else if (option == "--metrics") { if (!value(report.metricsFile)) return false; }
+            else if (option == "--trace") { if (!value(report.traceFile)) return false; }
+            else if (option == "--trace-hw") report.traceHardware = true;
+            else if (option == "--thread-scaling") {
+                if (!value(text)) return false;
+                report.threadScaling = std::atoi(text.c_str());
+            }
+            else if (option == "--batch-manifest") { if (!value(batch.manifest)) return false; }
+            else if (option == "--batch-dir") { if (!value(batch.inputDirectory) || !value(batch.outputDirectory)) return false; }
+            else if (option == "--io-threads") {
+                if (!value(text)) return false;
+                batch.ioThreads = std::atoi(text.c_str());
+            }
+            else if (option == "--method") {
+                if (!value(text)) return false;
+                if (text == "phase") config.matchingMethod = CorrespondenceMatching::MatchingMethod::Phase;
+                else if (text == "block") config.matchingMethod = CorrespondenceMatching::MatchingMethod::BlockMatching;
+                else if (text == "exact") config.matchingMethod = CorrespondenceMatching::MatchingMethod::ExactMatch;
+                else return false;
+            }
+            else if (option == "--threads") {
+                if (!value(text)) return false;
+                config.bilateral.threads = std::atoi(text.c_str());
+            }
+            else if (option == "--phase-size" || option == "--mesh-size") {
+                std::string other;
+                if (!value(text) || !value(other)) return false;
+                const int width = std::atoi(text.c_str()), height = std::atoi(other.c_str());
+                if (option == "--phase-size") {
+                    config.phaseShifting.width = width;
+                    config.phaseShifting.height = height;
+                }
+                else {
+                    config.bilateral.width = width;
+                    config.bilateral.height = height;
+                }
+            }
+            else if (option == "--phase-step") {
+                if (!value(text)) return false;
+                config.phaseShifting.phaseShiftDegrees = std::strtod(text.c_str(), nullptr);
+                config.phaseShifting.formula = PhaseFormula::GeneralStep;
+            }
+            else if (option == "--radius") {
+                if (!value(text)) return false;
+                config.bilateral.radius = std::atoi(text.c_str());
+            }
+            else if (option == "--full-window") config.bilateral.separable = false;
+            else if (option == "--stream-bands") {
+                if (!value(text)) return false;
+                config.bilateral.streamingBandRows = std::atoi(text.c_str());
+            }
+            else if (option == "--organized-output") config.bilateral.organizedOutput = true;
+            else if (option == "--sigmas") {
+                std::string other;
+                if (!value(text) || !value(other)) return false;
+                config.bilateral.spatialSigma = std::strtof(text.c_str(), nullptr);
+                config.bilateral.rangeSigma = std::strtof(other.c_str(), nullptr);
+            }
+            else if (option == "--distance-sigma") {
+                if (!value(text)) return false;
+                config.bilateral.distanceSigma = std::strtof(text.c_str(), nullptr);
+            }
+            else if (option == "--reference") {
+                if (!value(config.referenceRawPly) || !value(config.referenceFilteredPly)) return false;
+            }
+            else if (option == "--tolerance") {
+                if (!value(text)) return false;
+                config.changeTolerance = std::strtof(text.c_str(), nullptr);
+            }
+            else if (option == "--iterations") {
+                if (!value(text)) return false;
+                config.bilateral.iterations = std::atoi(text.c_str());
+            }
+            else if (option == "--double") {
+                config.phaseShifting.doublePrecision = true;
+                config.bilateral.doublePrecision = true;
+            }
+            else if (option == "--fx" || option == "--fy" || option == "--cx" || option == "--cy" || option == "--baseline") {
+                if (!value(text)) return false;
+                const float number = std::strtof(text.c_str(), nullptr);
+                if (option == "--fx") config.intrinsics.fx = number;
+                else if (option == "--fy") config.intrinsics.fy = number;
+                else if (option == "--baseline") config.intrinsics.baseline = number;
+                else {
+                    (option == "--cx" ? config.intrinsics.cx : config.intrinsics.cy) = number;
+                    config.principalPointAtCenter = false;
+                }
+            }
+            else return false;
+        }
+        return true;
+    }
+
+    int runBatch(const PipelineConfig& config, const BatchOptions& options, const ReportOptions& reportOptions)
+    {
+        //every scan only goes through the bilateral filter, the options of the other stages would be dropped silently
+        if (config.decodePhase || !config.phaseOutput.empty() || !config.patternOutput.empty() || !config.leftPhaseMap.empty()
+            || !config.rightPhaseMap.empty() || !config.inputPly.empty() || !config.outputPly.empty() || !config.filter
+            || !config.referenceRawPly.empty() || !config.compactOutput.empty() || config.bilateral.streamingBandRows > 0
+            || !reportOptions.metricsFile.empty() || reportOptions.threadScaling > 0) {
+            std::cerr << "Batch mode only filters the listed meshes, it takes the filter options, --threads, --io-threads and --trace" << std::endl;
+            return 2;
+        }
+        std::vector<BatchJob> jobs;
+        const bool listed = options.manifest.empty() ? BatchProcessor::scanDirectory(options.inputDirectory, options.outputDirectory, jobs)
+                                                     : BatchProcessor::readManifest(options.manifest, jobs);
+        if (!listed) return 1;
+        BatchConfig batchConfig;
+        batchConfig.filter = config.bilateral;
+        batchConfig.ioThreads = options.ioThreads;
+        batchConfig.workers = config.bilateral.threads;
+        BatchProcessor processor(batchConfig);
+        const BatchReport report = processor.run(jobs);
+        std::cout << "Batch: " << report.scans << " scans, " << report.failed << " failed, " << report.seconds << " s, "
+                  << report.scansPerSecond << " scans/s, readers waited " << report.readerStallSeconds
+                  << " s for buffers, workers waited " << report.workerStallSeconds << " s for writers" << std::endl;
+        return report.failed == 0 ? 0 : 1;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        PipelineConfig config;
+        BatchOptions batch;
+        ReportOptions report;
+        if (!parseArguments(argc, argv, config, batch, report)) {
+            printUsage(argv[0]);
+            return 2;
+        }
+        if (!report.traceFile.empty()) Trace::enable(report.traceHardware);
+        int status = 0;
+        if (!batch.manifest.empty() || !batch.inputDirectory.empty()) {
+            status = runBatch(config, batch, report);
+        }
+        else if (report.threadScaling > 0) {
+            if (config.inputPly.empty()) {
+                std::cerr << "--thread-scaling needs a --ply-in mesh" << std::endl;
+                return 2;
+            }
+            BilateralFilter bilateralFilter(config.inputPly, "", config.bilateral);
+            status = bilateralFilter.reportThreadScaling(report.threadScaling) ? 0 : 1;
+        }
+        else {
+            KiviPipeline pipeline(config);
+            status = pipeline.run() ? 0 : 1;
+            if (report.metricsFile == "-") {
+                pipeline.writeMetricsJson(std::cout);
+            }
+            else if (!report.metricsFile.empty()) {
+                std::ofstream out(report.metricsFile);
+                pipeline.writeMetricsJson(out);
+            }
+        }
+        if (!report.traceFile.empty()) {
+            Trace::disable();
+            if (!Trace::writeChromeTrace(report.traceFile)) status = 1;
+        }
+        return status;
+    }
 /*
     DoubleThreeStepPhaseShifting phaseShifting;
     phaseShifting.processPhaseShift();
 */
 
     BilateralFilter bilateralFilter("3D-bilateral/OriginalMesh.ply", "FilteredMesh.ply");
-    bilateralFilter.processFilter();
+    if (!bilateralFilter.processFilter()) return 1;
 
 /*
     CorrespondenceMatching matcher;